@@ -0,0 +1,44 @@
+--
+-- Certificate compression (RFC 8879): the chain is compressed once, when
+-- the context is created. Needs OpenSSL 3.2 built with zlib, brotli or
+-- zstd.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   chain = true,
+   certcompression = true,
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local stats = ctx:stats()
+print("certificate message: " .. stats.cert_size .. " bytes")
+for _, alg in ipairs{"zlib", "brotli", "zstd"} do
+   local size = stats["cert_size_" .. alg]
+   if size then
+      print(string.format("  %-6s %5d bytes", alg, size))
+   end
+end
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+while true do
+   local peer = server:accept()
+   peer = assert( ssl.wrap(peer, ctx) )
+   if peer:dohandshake() then
+      peer:send("certificate compression test\n")
+   end
+   peer:close()
+end
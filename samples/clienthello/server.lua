@@ -0,0 +1,68 @@
+--
+-- Look at the ClientHello before the key exchange: clients without a
+-- server name or TLS 1.2 are rejected in C, the function rejects the
+-- ones without an X25519 key share and routes "api" to its own context.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local api = assert( ssl.newcontext{
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverBkey.pem",
+   certificate = "../certs/serverB.pem",
+   options = {"all", "no_sslv2"},
+} )
+
+local function has(list, value)
+   for _, v in ipairs(list) do
+      if v == value then return true end
+   end
+   return false
+end
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   clienthello = {
+      requiresni = true,
+      minversion = "tlsv1_2",
+      callback = function(hello)
+         print(hello.servername, table.concat(hello.versions, " "),
+               table.concat(hello.keyshares, " "),
+               table.concat(hello.alpn, " "), #hello.ciphers .. " ciphers")
+         if has(hello.versions, "tlsv1_3") and
+            not has(hello.keyshares, "X25519") then
+            return false
+         end
+         if hello.servername == "api.example.com" then
+            return api
+         end
+      end,
+   },
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+while true do
+   local peer = server:accept()
+   peer = assert( ssl.wrap(peer, ctx) )
+   if peer:dohandshake() then
+      peer:send("clienthello test\n")
+   end
+   peer:close()
+   local stats = ctx:stats()
+   print(string.format("accepted=%d rejected=%d switched=%d",
+                       stats.hello_accepted, stats.hello_rejected,
+                       stats.hello_switched))
+end
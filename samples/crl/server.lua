@@ -0,0 +1,50 @@
+--
+-- Revocation checking with indexed CRLs: the lists are loaded once and
+-- shared by the contexts; delta CRLs are merged without reloading the
+-- base. DER files load faster than PEM ones.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local crl = assert( ssl.crl.new{
+   dir = arg[1] or "crl",           -- *.crl, *.der, *.pem or *.r0 files
+   cafile = "../certs/rootA.pem",   -- issuers of the CRLs
+} )
+print(crl:count() .. " revoked certificates")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   cafile = "../certs/rootA.pem",
+   verify = {"peer", "fail_if_no_peer_cert"},
+   options = {"all", "no_sslv2"},
+   crl = crl,
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+server:settimeout(60)
+
+while true do
+   local peer = server:accept()
+   if peer then
+      peer = assert( ssl.wrap(peer, ctx) )
+      local succ, msg = peer:dohandshake()
+      print(succ and "accepted" or ("rejected: " .. tostring(msg)))
+      if succ then peer:send("crl test\n") end
+      peer:close()
+   end
+   -- Merge the latest delta CRL, if any
+   local succ, msg = crl:delta{file = "delta.crl"}
+   if succ then
+      print("delta merged, generation " .. crl:generation())
+   end
+end
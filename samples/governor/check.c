@@ -0,0 +1,240 @@
+/*
+ * Check that a client offering a ticket the server cannot use does not
+ * bypass the governor: once the only place is taken, its handshake is
+ * deferred (or refused if nothing may wait) instead of getting an
+ * uncounted full handshake. A real resumption still goes through.
+ *
+ * Build from this directory and run:
+ *
+ *   cc -I../../src check.c ../../src/governor.c ../../src/hello.c \
+ *      -lssl -lcrypto -llua5.1 -o check && ./check
+ *
+ * Public domain
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "context.h"
+
+typedef struct t_conn_ {
+  SSL *client;
+  SSL *server;
+  int done;
+  int error;                /* SSL_get_error() of the server */
+} t_conn;
+
+static t_context govctx;
+static t_governor gov;
+static int failures = 0;
+
+/*--------------------------- Server Callbacks -------------------------------*/
+
+/* Same wiring as context.c: hello, certificate and state callbacks */
+static int hello_cb(SSL *ssl, int *al, void *arg)
+{
+  return governor_admit(&gov, ssl, SSL_get_SSL_CTX(ssl), al);
+}
+
+static int cert_cb(SSL *ssl, void *arg)
+{
+  return governor_full(ssl);
+}
+
+static void info_cb(const SSL *ssl, int where, int ret)
+{
+  if ((where & SSL_CB_HANDSHAKE_DONE) ||
+      ((where & SSL_CB_ALERT) && (ret >> 8) == SSL3_AL_FATAL))
+    governor_release((SSL*)ssl);
+}
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+static void check(int cond, const char *what)
+{
+  printf("%-52s %s\n", what, cond ? "ok" : "FAILED");
+  if (!cond)
+    failures++;
+}
+
+/**
+ * Create a server context with a fresh key and self-signed certificate,
+ * and so its own ticket keys.
+ */
+static SSL_CTX *new_server(int governed)
+{
+  X509 *cert = X509_new();
+  EVP_PKEY *key = NULL;
+  EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+  EVP_PKEY_keygen_init(kctx);
+  EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1);
+  EVP_PKEY_keygen(kctx, &key);
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+  X509_gmtime_adj(X509_getm_notAfter(cert), 3600);
+  X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC,
+    (const unsigned char*)"localhost", -1, -1, 0);
+  X509_set_issuer_name(cert, X509_get_subject_name(cert));
+  X509_set_pubkey(cert, key);
+  X509_sign(cert, key, EVP_sha256());
+  SSL_CTX_use_certificate(ctx, cert);
+  SSL_CTX_use_PrivateKey(ctx, key);
+  if (governed) {
+    govctx.governor = &gov;
+    SSL_CTX_set_app_data(ctx, &govctx);
+    SSL_CTX_set_client_hello_cb(ctx, hello_cb, NULL);
+    SSL_CTX_set_cert_cb(ctx, cert_cb, NULL);
+    SSL_CTX_set_info_callback(ctx, info_cb);
+  }
+  X509_free(cert);
+  EVP_PKEY_free(key);
+  EVP_PKEY_CTX_free(kctx);
+  return ctx;
+}
+
+/**
+ * Connect a client to a server through a BIO pair.
+ */
+static void conn_new(t_conn *c, SSL_CTX *cctx, SSL_CTX *sctx,
+  SSL_SESSION *sess)
+{
+  BIO *cbio, *sbio;
+  c->client = SSL_new(cctx);
+  c->server = SSL_new(sctx);
+  BIO_new_bio_pair(&cbio, 0, &sbio, 0);
+  SSL_set_bio(c->client, cbio, cbio);
+  SSL_set_bio(c->server, sbio, sbio);
+  SSL_set_connect_state(c->client);
+  SSL_set_accept_state(c->server);
+  if (sess)
+    SSL_set_session(c->client, sess);
+  c->done = 0;
+  c->error = SSL_ERROR_NONE;
+}
+
+/**
+ * Run both sides until the server is done, fails or waits for a place.
+ */
+static void conn_run(t_conn *c)
+{
+  int i, ret;
+  for (i = 0; i < 16 && !c->done; i++) {
+    SSL_do_handshake(c->client);
+    ret = SSL_do_handshake(c->server);
+    c->done = (ret == 1);
+    c->error = c->done ? SSL_ERROR_NONE : SSL_get_error(c->server, ret);
+    if (c->error != SSL_ERROR_WANT_READ && c->error != SSL_ERROR_NONE)
+      break;
+  }
+  /* Let the client read the TLS 1.3 tickets */
+  if (c->done) {
+    char buf[1];
+    SSL_read(c->client, buf, sizeof(buf));
+  }
+}
+
+static void conn_free(t_conn *c)
+{
+  SSL_free(c->client);
+  SSL_free(c->server);
+}
+
+/**
+ * Start a full handshake and stop before the server's first flight is
+ * read by the client: the place stays taken.
+ */
+static void take_place(t_conn *c, SSL_CTX *cctx, SSL_CTX *sctx)
+{
+  conn_new(c, cctx, sctx, NULL);
+  SSL_do_handshake(c->client);
+  SSL_do_handshake(c->server);
+}
+
+/**
+ * Get a session from a server.
+ */
+static SSL_SESSION *get_session(SSL_CTX *cctx, SSL_CTX *sctx)
+{
+  t_conn c;
+  SSL_SESSION *sess;
+  conn_new(&c, cctx, sctx, NULL);
+  conn_run(&c);
+  sess = SSL_get1_session(c.client);
+  /* Closed properly, the session stays resumable */
+  SSL_shutdown(c.client);
+  conn_free(&c);
+  return sess;
+}
+
+/*----------------------------------- Main -----------------------------------*/
+
+static void run(int version, const char *name)
+{
+  t_conn busy, bogus, resumed;
+  SSL_CTX *cctx = SSL_CTX_new(TLS_client_method());
+  SSL_CTX *server = new_server(1);
+  SSL_CTX *other = new_server(0);
+  SSL_SESSION *good, *stale;
+  char what[64];
+  SSL_CTX_set_min_proto_version(cctx, version);
+  SSL_CTX_set_max_proto_version(cctx, version);
+  memset(&gov, 0, sizeof(gov));
+  gov.maxfull = 100;
+  good = get_session(cctx, server);
+  stale = get_session(cctx, other);
+
+  /* One place, nothing may wait: the stale ticket is refused */
+  gov.maxfull = 1;
+  gov.maxwaiting = 0;
+  take_place(&busy, cctx, server);
+  conn_new(&bogus, cctx, server, stale);
+  conn_run(&bogus);
+  snprintf(what, sizeof(what), "%s: stale ticket at the cap is refused", name);
+  check(!bogus.done && bogus.error == SSL_ERROR_SSL && gov.shed == 1 &&
+    gov.active == 1, what);
+  conn_free(&bogus);
+
+  /* One may wait: it is deferred, then gets the place */
+  gov.maxwaiting = 1;
+  conn_new(&bogus, cctx, server, stale);
+  conn_run(&bogus);
+  snprintf(what, sizeof(what), "%s: stale ticket at the cap is deferred", name);
+  check(!bogus.done && bogus.error == SSL_ERROR_WANT_X509_LOOKUP &&
+    governor_waiting(bogus.server) && gov.waiting == 1, what);
+  conn_run(&busy);
+  conn_run(&bogus);
+  snprintf(what, sizeof(what), "%s: deferred one runs a counted handshake",
+    name);
+  check(bogus.done && !SSL_session_reused(bogus.server) &&
+    gov.notresumed == 1 && gov.active == 0 && gov.waiting == 0, what);
+  conn_free(&bogus);
+  conn_free(&busy);
+
+  /* A session the server resumes needs no place */
+  take_place(&busy, cctx, server);
+  conn_new(&resumed, cctx, server, good);
+  conn_run(&resumed);
+  snprintf(what, sizeof(what), "%s: resumption at the cap goes through", name);
+  check(resumed.done && SSL_session_reused(resumed.server) &&
+    gov.active == 1, what);
+  conn_free(&resumed);
+  conn_free(&busy);
+
+  SSL_SESSION_free(good);
+  SSL_SESSION_free(stale);
+  SSL_CTX_free(cctx);
+  SSL_CTX_free(server);
+  SSL_CTX_free(other);
+}
+
+int main(void)
+{
+  run(TLS1_2_VERSION, "TLS 1.2");
+  run(TLS1_3_VERSION, "TLS 1.3");
+  return failures ? 1 : 0;
+}
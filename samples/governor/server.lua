@@ -0,0 +1,61 @@
+--
+-- Ration the full handshakes during a reconnect storm: at most 'full'
+-- run at the same time, 'waiting' more are deferred and retried, the
+-- others get an alert right after their ClientHello. Clients that resume
+-- a session are always admitted; a ticket the server cannot use costs a
+-- place like a new client.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   governor = {full = 8, waiting = 32},
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen(128)
+server:settimeout(0.01)
+
+local pending = {}
+local served = 0
+while true do
+   local peer = server:accept()
+   if peer then
+      peer = ssl.wrap(peer, ctx)
+      peer:settimeout(0)
+      pending[#pending + 1] = peer
+   end
+   -- Drive the handshakes; "deferred" ones wait for a free place
+   for i = #pending, 1, -1 do
+      local conn = pending[i]
+      local succ, msg = conn:dohandshake()
+      if succ then
+         conn:send("admitted\n")
+         conn:close()
+         table.remove(pending, i)
+         served = served + 1
+         if served % 100 == 0 then
+            local s = ctx:stats()
+            print("admitted", s.handshakes_admitted, "resumable",
+                  s.handshakes_resumable, "not resumed",
+                  s.handshakes_not_resumed, "deferred", s.handshakes_deferred,
+                  "shed", s.handshakes_shed)
+         end
+      elseif msg ~= "wantread" and msg ~= "wantwrite" and
+             msg ~= "deferred" then
+         conn:close()
+         table.remove(pending, i)
+      end
+   end
+end
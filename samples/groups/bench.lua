@@ -0,0 +1,59 @@
+--
+-- Handshake CPU time for each key exchange group. Both ends run in this
+-- process, over the loopback, so the time covers client and server.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local rounds = tonumber(arg[1]) or 200
+local groups = {"X25519", "P-256", "P-384", "P-521", "ffdhe2048"}
+
+local server = assert( socket.bind("127.0.0.1", 0) )
+local host, port = server:getsockname()
+
+local function params(mode, group)
+   return {
+      mode = mode,
+      protocol = "sslv23",
+      key = (mode == "server") and "../certs/serverAkey.pem" or nil,
+      certificate = (mode == "server") and "../certs/serverA.pem" or nil,
+      options = {"all", "no_sslv2"},
+      groups = group,
+   }
+end
+
+-- Drive both ends of the handshake until they are done
+local function handshake(sctx, cctx)
+   local client = socket.tcp()
+   client:settimeout(0)
+   client:connect(host, port)
+   local peer = assert( server:accept() )
+   client = assert( ssl.wrap(client, cctx) )
+   peer = assert( ssl.wrap(peer, sctx) )
+   client:settimeout(0)
+   peer:settimeout(0)
+   local cdone, sdone
+   repeat
+      cdone = cdone or client:dohandshake()
+      sdone = sdone or peer:dohandshake()
+   until cdone and sdone
+   client:close()
+   peer:close()
+end
+
+for _, group in ipairs(groups) do
+   local sctx, msg = ssl.newcontext(params("server", group))
+   local cctx = sctx and ssl.newcontext(params("client", group))
+   if not cctx then
+      print(string.format("%-10s not supported (%s)", group, tostring(msg)))
+   else
+      local start = os.clock()
+      for i = 1, rounds do
+         handshake(sctx, cctx)
+      end
+      print(string.format("%-10s %8.3f ms CPU per handshake", group,
+                          (os.clock() - start) / rounds * 1000))
+   end
+end
@@ -0,0 +1,44 @@
+--
+-- Print the I/O counters of a connection, then the totals of the
+-- context once it is closed.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local peer = socket.tcp()
+peer:connect("127.0.0.1", 8888)
+peer = assert( ssl.wrap(peer, ctx) )
+assert( peer:dohandshake() )
+peer:send("GET / HTTP/1.0\r\n\r\n")
+peer:receive("*a")
+
+local function show(t)
+   local names = {}
+   for k in pairs(t) do names[#names + 1] = k end
+   table.sort(names)
+   for _, k in ipairs(names) do
+      print(string.format("  %-22s %s", k, tostring(t[k])))
+   end
+end
+
+print("connection")
+show(peer:stats())
+peer:close()
+
+print("context")
+local stats = ctx:stats()
+local io = {}
+for k, v in pairs(stats) do
+   if k:match("^io_") then io[k] = v end
+end
+show(io)
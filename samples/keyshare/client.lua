@@ -0,0 +1,49 @@
+--
+-- The server only accepts P-384, which the client does not offer first:
+-- the first handshake gets a HelloRetryRequest, the next ones do not.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local server = assert( socket.bind("127.0.0.1", 0) )
+local host, port = server:getsockname()
+
+local sctx = assert( ssl.newcontext{
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   groups = "P-384",
+} )
+
+local cctx = assert( ssl.newcontext{
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   groups = {"X25519", "P-256", "P-384"},
+   keyshare = true,
+} )
+
+for i = 1, 3 do
+   local client = socket.tcp()
+   client:settimeout(0)
+   client:connect(host, port)
+   local peer = assert( server:accept() )
+   client = assert( ssl.wrap(client, cctx) )
+   peer = assert( ssl.wrap(peer, sctx) )
+   client:settimeout(0)
+   peer:settimeout(0)
+   local cdone, sdone
+   repeat
+      cdone = cdone or client:dohandshake()
+      sdone = sdone or peer:dohandshake()
+   until cdone and sdone
+   client:close()
+   peer:close()
+   local stats = cctx:stats()
+   print(string.format("handshake %d: hrr=%d predicted=%d", i,
+                       stats.hrr, stats.keyshare_predicted))
+end
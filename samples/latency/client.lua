@@ -0,0 +1,48 @@
+--
+-- Send requests over several connections and print the latency
+-- percentiles of the last connection, then of all the connections of
+-- the context. The histograms can be switched on and off at run time.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   latency = true,
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local function show(title, lat)
+   print(title)
+   for _, op in ipairs({"handshake", "send", "receive"}) do
+      local h = lat[op]
+      print(string.format("  %-10s n=%-5d p50=%.3fms p99=%.3fms max=%.3fms",
+                          op, h.count, h.p50 * 1000, h.p99 * 1000,
+                          h.max * 1000))
+   end
+end
+
+local peer
+for i = 1, 20 do
+   peer = socket.tcp()
+   peer:connect("127.0.0.1", 8888)
+   peer = assert( ssl.wrap(peer, ctx) )
+   assert( peer:dohandshake() )
+   for j = 1, 50 do
+      peer:send("ping\n")
+      peer:receive("*l")
+   end
+   if i < 20 then peer:close() end
+end
+
+show("last connection", peer:latency())
+peer:close()
+show("context", ctx:latency())
+
+-- Stop recording on the context (and forget the totals)
+ctx:setlatency(false)
@@ -0,0 +1,51 @@
+--
+-- Load the key pair and the CAs from strings, as handed by a secrets
+-- agent, without writing them to files. The key is parsed once and
+-- shared by the contexts.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local function slurp(name)
+   local f = assert( io.open(name, "rb") )
+   local data = f:read("*a")
+   f:close()
+   return data
+end
+
+-- PEM or DER strings, e.g., received from the agent
+local keydata  = slurp("../certs/serverAkey.pem")
+local certdata = slurp("../certs/serverA.pem")
+local cadata   = slurp("../certs/rootA.pem")
+
+local key = assert( ssl.key.new(keydata) )
+print("key", key:info())
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = key,
+   certificatedata = certdata,
+   cadata = cadata,
+   verify = {"peer", "fail_if_no_peer_cert"},
+   options = {"all", "no_sslv2"},
+}
+
+-- Several contexts (e.g., workers) use the same parsed key
+local contexts = {}
+for i = 1, 4 do
+   contexts[i] = assert( ssl.newcontext(params) )
+end
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+local peer = server:accept()
+peer = assert( ssl.wrap(peer, contexts[1]) )
+assert( peer:dohandshake() )
+peer:send("loaded from memory\n")
+peer:close()
@@ -0,0 +1,75 @@
+--
+-- TLS server exporting its counters: any plain HTTP request on port
+-- 9100 gets ssl.metrics.render() (Prometheus text format), and the
+-- handshake and byte rates are printed every 10 seconds.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   metrics = "api",
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+server:settimeout(0.1)
+
+local scrape = socket.tcp()
+scrape:setoption('reuseaddr', true)
+assert( scrape:bind("127.0.0.1", 9100) )
+scrape:listen()
+scrape:settimeout(0)
+
+local last = socket.gettime()
+ssl.metrics.snapshot()
+
+while true do
+   local peer = server:accept()
+   if peer then
+      peer = ssl.wrap(peer, ctx)
+      peer:settimeout(5)
+      if peer:dohandshake() then
+         peer:send("hello\n")
+      end
+      peer:close()
+   end
+
+   local client = scrape:accept()
+   if client then
+      client:settimeout(1)
+      client:receive("*l")
+      local body = ssl.metrics.render()
+      client:send("HTTP/1.0 200 OK\r\n" ..
+                  "Content-Type: text/plain; version=0.0.4\r\n" ..
+                  "Content-Length: " .. #body .. "\r\n\r\n" .. body)
+      client:close()
+   end
+
+   if socket.gettime() - last >= 10 then
+      last = socket.gettime()
+      local snap = ssl.metrics.snapshot()
+      print(string.format("last %.1fs", snap.interval))
+      for _, s in ipairs(snap) do
+         if s.delta ~= 0 then
+            local labels = {}
+            for k, v in pairs(s.labels) do
+               labels[#labels + 1] = k .. "=" .. v
+            end
+            table.sort(labels)
+            print(string.format("  %-36s %-50s +%d (%.2f/s)", s.metric,
+                                table.concat(labels, ","), s.delta, s.rate))
+         end
+      end
+   end
+end
@@ -0,0 +1,39 @@
+--
+-- Check the OCSP status stapled by the server. The verified statuses are
+-- cached until their nextUpdate, so a later connection to a server that
+-- does not staple reuses them. Run it against:
+--
+--   openssl s_server -accept 8888 -cert serverA.pem -key serverAkey.pem \
+--     -status_file response.der
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local cache = ssl.ocsp.new(1024)
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   cafile = "../certs/rootA.pem",
+   verify = "peer",
+   options = {"all", "no_sslv2"},
+   ocsp = cache,
+   -- ocsprequired = true,  -- fail without a good status
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+for i = 1, 2 do
+   local peer = socket.tcp()
+   peer:connect("127.0.0.1", 8888)
+   peer = assert( ssl.wrap(peer, ctx) )
+   local succ, msg = peer:dohandshake()
+   print(succ and "accepted" or ("rejected: " .. tostring(msg)))
+   peer:close()
+end
+
+local stats = ctx:stats()
+print("stapled", stats.ocsp_stapled, "cached", stats.ocsp_hits,
+      "missing", stats.ocsp_misses, "entries", cache:count())
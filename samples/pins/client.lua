@@ -0,0 +1,33 @@
+--
+-- Accept the server only if its public key is pinned, without verifying
+-- the chain against a CA. Get the pin of a certificate with:
+--
+--   openssl x509 -in serverA.pem -pubkey -noout |
+--   openssl pkey -pubin -outform der | openssl dgst -sha256 -binary |
+--   openssl base64
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   pins = {
+      "sha256/" .. (arg[1] or "AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA="),
+   },
+   -- pinchain = true,  -- also verify the chain (needs cafile)
+}
+
+local peer = socket.tcp()
+peer:connect("127.0.0.1", 8888)
+
+peer = assert( ssl.wrap(peer, params) )
+local succ, msg = peer:dohandshake()
+print(succ and "pinned key" or ("rejected: " .. tostring(msg)))
+if succ then
+   print(peer:receive("*l"))
+end
+peer:close()
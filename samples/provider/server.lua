@@ -0,0 +1,59 @@
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+-- Certificates are looked up by server name and cached (at most 1000
+-- contexts or ~16MB). With 'async', a miss does not block: the handshake
+-- returns and the application supplies the context with ctx:provide().
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   options = {"all", "no_sslv2"},
+   provider = {
+      maxentries = 1000,
+      maxbytes = 16 * 1024 * 1024,
+      async = true,
+      loader = function(name) return nil end,
+   },
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local function load(name)
+   -- Map every name to the 'B' certificate
+   return ssl.newcontext {
+      mode = "server",
+      protocol = "sslv23",
+      key = "../certs/serverBkey.pem",
+      certificate = "../certs/serverB.pem",
+   }
+end
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+while true do
+   local peer = server:accept()
+   peer = assert( ssl.wrap(peer, ctx) )
+   local succ, msg = peer:dohandshake()
+   if not succ and peer:want() == "x509lookup" then
+      ctx:provide(peer:getservername(), load(peer:getservername()))
+      succ, msg = peer:dohandshake()
+   end
+   if succ then
+      peer:send("provider test\n")
+   else
+      print(msg)
+   end
+   peer:close()
+   local stats = ctx:stats()
+   print("hits", stats.cert_hits, "misses", stats.cert_misses,
+         "evictions", stats.cert_evictions,
+         "unknown evictions", stats.cert_unknown_evictions)
+end
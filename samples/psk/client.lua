@@ -0,0 +1,28 @@
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   ciphers = "ECDHE-PSK:PSK",
+   -- A function(hint) returning the identity and the key also works
+   psk = {
+      identity = "service-a",
+      key = "0123456789abcdef0123456789abcdef",
+   },
+}
+
+local peer = socket.tcp()
+peer:connect("127.0.0.1", 8888)
+
+peer = assert( ssl.wrap(peer, params) )
+assert( peer:dohandshake() )
+
+local info = peer:info()
+print(info.protocol, info.cipher)
+print(peer:receive("*l"))
+peer:close()
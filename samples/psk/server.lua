@@ -0,0 +1,40 @@
+--
+-- Pre-shared keys: no certificate, no asymmetric signature.
+-- TLS 1.3 clients use an external PSK; TLS 1.2 clients the PSK suites.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   ciphers = "ECDHE-PSK:PSK",
+   -- identity -> key (binary strings)
+   psk = {
+      ["service-a"] = "0123456789abcdef0123456789abcdef",
+      ["service-b"] = "fedcba9876543210fedcba9876543210",
+   },
+   pskhint = "internal",
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+while true do
+   local peer = server:accept()
+   peer = assert( ssl.wrap(peer, ctx) )
+   if peer:dohandshake() then
+      peer:send("psk test\n")
+   end
+   peer:close()
+   local stats = ctx:stats()
+   print(string.format("psk hits=%d misses=%d", stats.psk_hits,
+                       stats.psk_misses))
+end
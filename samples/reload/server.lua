@@ -0,0 +1,53 @@
+--
+-- Rotate the certificate of a listening server every 'n' connections,
+-- without a new context. The connections in progress keep the old
+-- certificate; the next handshakes use the new one.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local material = {
+   {key = "../certs/serverAkey.pem", certificate = "../certs/serverA.pem"},
+   {key = "../certs/serverBkey.pem", certificate = "../certs/serverB.pem"},
+}
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = material[1].key,
+   certificate = material[1].certificate,
+   options = {"all", "no_sslv2"},
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+local n = tonumber(arg[1]) or 10
+local current = 1
+local count = 0
+while true do
+   local peer = server:accept()
+   peer = ssl.wrap(peer, ctx)
+   if peer and peer:dohandshake() then
+      peer:send("certificate " .. current .. "\n")
+   end
+   if peer then peer:close() end
+   count = count + 1
+   if count % n == 0 then
+      local following = current % #material + 1
+      local succ, msg = ctx:reload(material[following])
+      if succ then
+         current = following
+      end
+      local stats = ctx:stats()
+      print(succ and "reloaded" or ("reload failed: " .. msg),
+            string.format("%.3f ms", stats.reload_time * 1000),
+            "failures", stats.reload_failures)
+   end
+end
@@ -0,0 +1,23 @@
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+}
+
+local name = arg[1] or "www.b.example.com"
+
+local peer = socket.tcp()
+peer:connect("127.0.0.1", 8888)
+
+peer = assert( ssl.wrap(peer, params) )
+assert( peer:setservername(name) )
+assert( peer:dohandshake() )
+
+print(peer:receive("*l"))
+peer:close()
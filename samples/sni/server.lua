@@ -0,0 +1,47 @@
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "server",
+   protocol = "sslv23",
+   key = "../certs/serverAkey.pem",
+   certificate = "../certs/serverA.pem",
+   cafile = "../certs/rootA.pem",
+   options = {"all", "no_sslv2"},
+   -- Contexts selected by the name sent by the client
+   sni = {
+      ["servera.example.com"] = {
+         mode = "server",
+         protocol = "sslv23",
+         key = "../certs/serverAkey.pem",
+         certificate = "../certs/serverA.pem",
+      },
+      ["*.b.example.com"] = {
+         mode = "server",
+         protocol = "sslv23",
+         key = "../certs/serverBkey.pem",
+         certificate = "../certs/serverB.pem",
+      },
+   },
+   snistrict = true,
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+while true do
+   local peer = server:accept()
+   peer = assert( ssl.wrap(peer, ctx) )
+   if peer:dohandshake() then
+      print("Server name: " .. tostring(peer:getservername()))
+      peer:send("sni test\n")
+   end
+   peer:close()
+end
@@ -0,0 +1,31 @@
+--
+-- Startup cost of the CA bundle, parsed from PEM or loaded from the
+-- binary cache.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local cafile = arg[1] or "/etc/ssl/certs/ca-certificates.crt"
+local cache  = arg[2] or os.tmpname()
+local rounds = tonumber(arg[3]) or 50
+
+local function bench(cfg)
+   local start = socket.gettime()
+   for i = 1, rounds do
+      assert( ssl.store.new(cfg) )
+      collectgarbage()
+   end
+   return (socket.gettime() - start) / rounds * 1000
+end
+
+assert( ssl.store.compile(cafile, cache) )
+
+local pem    = bench{cafile = cafile}
+local cached = bench{cafile = cafile, cache = cache}
+
+print(string.format("PEM bundle:   %8.3f ms", pem))
+print(string.format("Binary cache: %8.3f ms", cached))
+print(string.format("Saved:        %8.3f ms per start", pem - cached))
+os.remove(cache)
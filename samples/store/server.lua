@@ -0,0 +1,47 @@
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+-- The CA certificates are parsed once and shared by both contexts
+local store = assert( ssl.store.new{cafile = "../certs/rootA.pem"} )
+
+local function params(name)
+   return {
+      mode = "server",
+      protocol = "sslv23",
+      key = "../certs/server" .. name .. "key.pem",
+      certificate = "../certs/server" .. name .. ".pem",
+      store = store,
+      verify = {"peer", "fail_if_no_peer_cert"},
+      options = {"all", "no_sslv2"},
+   }
+end
+
+local ctxA = assert( ssl.newcontext(params("A")) )
+local ctxB = assert( ssl.newcontext(params("B")) )
+print("Certificates in the store: " .. store:count())
+
+local server = socket.tcp()
+server:setoption('reuseaddr', true)
+assert( server:bind("127.0.0.1", 8888) )
+server:listen()
+
+local n = 0
+while true do
+   local peer = server:accept()
+   n = n + 1
+   peer = assert( ssl.wrap(peer, (n % 2 == 0) and ctxA or ctxB) )
+   if peer:dohandshake() then
+      peer:send("store test\n")
+   end
+   peer:close()
+   -- Trust both roots from now on: one swap updates both contexts
+   if n == 10 then
+      local pem = io.open("../certs/rootA.pem"):read("*a") ..
+                  io.open("../certs/rootB.pem"):read("*a")
+      assert( store:reload{pem = pem} )
+      print("Reloaded, generation " .. store:generation())
+   end
+end
@@ -0,0 +1,78 @@
+--
+-- Parallel reconnects: after one full handshake, open N connections to
+-- the same server at once and count how many resume. With one ticket per
+-- handshake only one of them can; with N tickets all of them do.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local parallel = tonumber(arg[1]) or 8
+
+local server = assert( socket.bind("127.0.0.1", 0) )
+local host, port = server:getsockname()
+
+local function contexts(tickets)
+   local sctx = assert( ssl.newcontext{
+      mode = "server",
+      protocol = "sslv23",
+      key = "../certs/serverAkey.pem",
+      certificate = "../certs/serverA.pem",
+      options = {"all", "no_sslv2"},
+      tickets = tickets,
+   } )
+   local cctx = assert( ssl.newcontext{
+      mode = "client",
+      protocol = "sslv23",
+      options = {"all", "no_sslv2"},
+      sessionstore = {sessions = tickets},
+   } )
+   return sctx, cctx
+end
+
+-- Start 'n' connections, then drive all the handshakes together. The
+-- server sends the tickets after the handshake, so the clients read
+-- once to receive them.
+local function connect(sctx, cctx, n)
+   local conns = {}
+   for i = 1, n do
+      local client = socket.tcp()
+      client:settimeout(0)
+      client:connect(host, port)
+      local peer = assert( server:accept() )
+      client = assert( ssl.wrap(client, cctx) )
+      peer = assert( ssl.wrap(peer, sctx) )
+      client:settimeout(0)
+      peer:settimeout(0)
+      conns[i] = {client = client, peer = peer}
+   end
+   local pending = n
+   while pending > 0 do
+      pending = 0
+      for _, p in ipairs(conns) do
+         p.cdone = p.cdone or p.client:dohandshake()
+         p.sdone = p.sdone or p.peer:dohandshake()
+         if not (p.cdone and p.sdone) then pending = pending + 1 end
+      end
+   end
+   local reused = 0
+   for _, p in ipairs(conns) do
+      p.peer:send("x\n")
+      p.client:settimeout(1)
+      p.client:receive("*l")
+      if p.client:reused() then reused = reused + 1 end
+      p.client:close()
+      p.peer:close()
+   end
+   return reused
+end
+
+for _, tickets in ipairs{1, parallel} do
+   local sctx, cctx = contexts(tickets)
+   connect(sctx, cctx, 1)
+   local start = os.clock()
+   local reused = connect(sctx, cctx, parallel)
+   print(string.format("%2d ticket(s): %d/%d resumed, %.3f ms CPU", tickets,
+                       reused, parallel, (os.clock() - start) * 1000))
+end
@@ -0,0 +1,50 @@
+--
+-- Connect several times, resuming the session, and show where the time
+-- of the handshakes goes: per connection, then the percentiles of the
+-- context for the full and the resumed handshakes.
+--
+-- Public domain
+--
+require("socket")
+require("ssl")
+
+local params = {
+   mode = "client",
+   protocol = "sslv23",
+   options = {"all", "no_sslv2"},
+   timing = true,
+}
+
+local ctx = assert( ssl.newcontext(params) )
+
+local phases = {"clienthello", "serverhello", "certificate", "keyexchange",
+                "finished", "done"}
+
+local function ms(t)
+   return t and string.format("%8.3f", t * 1000) or "       -"
+end
+
+local session
+for i = 1, 10 do
+   local peer = socket.tcp()
+   peer:connect("127.0.0.1", 8888)
+   peer = assert( ssl.wrap(peer, ctx) )
+   if session then peer:setsession(session) end
+   assert( peer:dohandshake() )
+   session = peer:getsession()
+   local t = peer:timing()
+   local line = {}
+   for _, name in ipairs(phases) do line[#line + 1] = ms(t[name]) end
+   print(t.resumed and "resumed" or "full   ", table.concat(line, " "))
+   peer:close()
+end
+
+local all = ctx:timing()
+for _, kind in ipairs({"full", "resumed"}) do
+   print(kind)
+   for _, name in ipairs(phases) do
+      local h = all[kind][name]
+      print(string.format("  %-12s n=%-4d p50=%sms p99=%sms", name, h.count,
+                          ms(h.p50), ms(h.p99)))
+   end
+end
@@ -39,6 +39,7 @@ void buffer_init(p_buffer buf, p_io io, p_timeout tm) {
     buf->first = buf->last = 0;
     buf->io = io;
     buf->tm = tm;
+    buf->sendlat = buf->recvlat = NULL;
 }
 
 /*-------------------------------------------------------------------------*\
@@ -51,7 +52,8 @@ int buffer_meth_send(lua_State *L, p_buffer buf) {
     const char *data = luaL_checklstring(L, 2, &size);
     long start = (long) luaL_optnumber(L, 3, 1);
     long end = (long) luaL_optnumber(L, 4, -1);
-    p_timeout tm = timeout_markstart(buf->tm);
+    double t0 = buf->sendlat ? hist_clock() : 0;
+    timeout_markstart(buf->tm);
     if (start < 0) start = (long) (size+start+1);
     if (end < 0) end = (long) (size+end+1);
     if (start < 1) start = (long) 1;
@@ -66,11 +68,8 @@ int buffer_meth_send(lua_State *L, p_buffer buf) {
         lua_pushnumber(L, sent+start-1);
         lua_pushnil(L);
         lua_pushnil(L);
+        if (buf->sendlat) hist_add(buf->sendlat, hist_clock() - t0);
     }
-#ifdef BUFFER_DEBUG
-    /* push time elapsed during operation as the last return value */
-    lua_pushnumber(L, timeout_gettime() - timeout_getstart(tm));
-#endif
     return lua_gettop(L) - top;
 }
 
@@ -82,7 +81,8 @@ int buffer_meth_receive(lua_State *L, p_buffer buf) {
     luaL_Buffer b;
     size_t size;
     const char *part = luaL_optlstring(L, 3, "", &size);
-    p_timeout tm = timeout_markstart(buf->tm);
+    double t0 = buf->recvlat ? hist_clock() : 0;
+    timeout_markstart(buf->tm);
     /* initialize buffer with optional extra prefix 
      * (useful for concatenating previous partial results) */
     luaL_buffinit(L, &b);
@@ -109,11 +109,8 @@ int buffer_meth_receive(lua_State *L, p_buffer buf) {
         luaL_pushresult(&b);
         lua_pushnil(L);
         lua_pushnil(L);
+        if (buf->recvlat) hist_add(buf->recvlat, hist_clock() - t0);
     }
-#ifdef BUFFER_DEBUG 
-    /* push time elapsed during operation as the last return value */
-    lua_pushnumber(L, timeout_gettime() - timeout_getstart(tm));
-#endif
     return lua_gettop(L) - top;
 }
 
@@ -24,6 +24,7 @@
 
 #include "io.h"
 #include "timeout.h"
+#include "hist.h"
 
 /* buffer size in bytes */
 #define BUF_SIZE 8192
@@ -33,6 +34,8 @@ typedef struct t_buffer_ {
     p_io io;                /* IO driver used for this buffer */
     p_timeout tm;           /* timeout management for this buffer */
     size_t first, last;     /* index of first and last bytes of stored data */
+    p_hist sendlat;         /* latency of the completed sends, or NULL */
+    p_hist recvlat;         /* latency of the completed receives, or NULL */
     char data[BUF_SIZE];    /* storage space for buffer data */
 } t_buffer;
 typedef t_buffer *p_buffer;
@@ -0,0 +1,483 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+/*
+ * Binary cache of a PEM CA bundle. The certificates are stored in DER,
+ * indexed by subject name hash, and the file is mapped instead of read.
+ * With OpenSSL 1.1.1 or later, a certificate is only decoded when the
+ * verification looks for it as an issuer, so loading the cache costs
+ * almost nothing. Layout (integers are big endian):
+ *
+ *   "LSECCA01"            magic
+ *   u64 mtime, u64 size   of the source file
+ *   32 bytes              SHA-256 of the source file
+ *   u32 count
+ *   count * (u32 subject hash, u32 offset, u32 length), sorted by hash
+ *   DER certificates
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+#include "bundle.h"
+
+#define BUNDLE_MAGIC   "LSECCA01"
+#define BUNDLE_KEY     48
+#define BUNDLE_HEADER  (8 + BUNDLE_KEY + 4)
+#define BUNDLE_ENTRY   12
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define BUNDLE_LAZY
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef const X509_NAME BUNDLE_NAME;
+#else
+typedef X509_NAME BUNDLE_NAME;
+#endif
+
+/* File contents, mapped or read in memory */
+typedef struct t_fmap_ {
+  unsigned char *data;
+  size_t size;
+  int mapped;
+} t_fmap;
+
+/* Certificate to be written in the cache */
+typedef struct t_bentry_ {
+  unsigned long hash;
+  unsigned char *der;
+  int len;
+} t_bentry;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Map (or read) the whole file.
+ */
+static int fmap_open(t_fmap *m, const char *path)
+{
+  FILE *fp;
+  struct stat st;
+  m->data = NULL;
+  m->size = 0;
+  m->mapped = 0;
+  if (stat(path, &st) != 0)
+    return 0;
+  m->size = (size_t)st.st_size;
+  if (m->size == 0)
+    return 1;
+#if !defined(_WIN32)
+  {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return 0;
+    m->data = (unsigned char*)mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m->data != (unsigned char*)MAP_FAILED) {
+      m->mapped = 1;
+      return 1;
+    }
+    m->data = NULL;
+  }
+#endif
+  fp = fopen(path, "rb");
+  if (!fp)
+    return 0;
+  m->data = (unsigned char*)malloc(m->size);
+  if (!m->data || fread(m->data, 1, m->size, fp) != m->size) {
+    free(m->data);
+    m->data = NULL;
+    fclose(fp);
+    return 0;
+  }
+  fclose(fp);
+  return 1;
+}
+
+/**
+ * Release the file contents.
+ */
+static void fmap_close(t_fmap *m)
+{
+#if !defined(_WIN32)
+  if (m->mapped) {
+    munmap(m->data, m->size);
+    m->data = NULL;
+    return;
+  }
+#endif
+  free(m->data);
+  m->data = NULL;
+}
+
+static void put_u32(unsigned char *p, unsigned long v)
+{
+  p[0] = (unsigned char)(v >> 24);
+  p[1] = (unsigned char)(v >> 16);
+  p[2] = (unsigned char)(v >> 8);
+  p[3] = (unsigned char)v;
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+  return ((unsigned long)p[0] << 24) | ((unsigned long)p[1] << 16) |
+         ((unsigned long)p[2] << 8) | (unsigned long)p[3];
+}
+
+/**
+ * Write the key of the source file: mtime, size and hash.
+ */
+static int make_key(const char *cafile, unsigned char *key)
+{
+  struct stat st;
+  t_fmap m;
+  unsigned int len;
+  int ret;
+  if (stat(cafile, &st) != 0 || !fmap_open(&m, cafile))
+    return 0;
+  /* Two shifts: the high word is zero when the types have 32 bits */
+  put_u32(key, (unsigned long)((st.st_mtime >> 16) >> 16));
+  put_u32(key + 4, (unsigned long)st.st_mtime);
+  put_u32(key + 8, (unsigned long)((m.size >> 16) >> 16));
+  put_u32(key + 12, (unsigned long)m.size);
+  ret = EVP_Digest(m.data ? m.data : (unsigned char*)"", m.size, key + 16,
+    &len, EVP_sha256(), NULL);
+  fmap_close(&m);
+  return ret;
+}
+
+/**
+ * Map the cache and check it against the source file and itself.
+ */
+static int open_cache(t_fmap *m, const char *cafile, const char *cache)
+{
+  size_t i;
+  unsigned long n;
+  unsigned char key[BUNDLE_KEY];
+  if (!make_key(cafile, key) || !fmap_open(m, cache))
+    return 0;
+  if (m->size < BUNDLE_HEADER || memcmp(m->data, BUNDLE_MAGIC, 8) ||
+      memcmp(m->data + 8, key, BUNDLE_KEY))
+    goto stale;
+  n = get_u32(m->data + BUNDLE_HEADER - 4);
+  if (n > (m->size - BUNDLE_HEADER) / BUNDLE_ENTRY)
+    goto stale;
+  for (i = 0; i < n; i++) {
+    const unsigned char *e = m->data + BUNDLE_HEADER + i * BUNDLE_ENTRY;
+    unsigned long off = get_u32(e + 4);
+    unsigned long len = get_u32(e + 8);
+    if (off > m->size || len > m->size - off)
+      goto stale;
+  }
+  return 1;
+stale:
+  fmap_close(m);
+  return 0;
+}
+
+/**
+ * Decode the i-th certificate of the cache.
+ */
+static X509 *decode(const unsigned char *data, unsigned long i)
+{
+  const unsigned char *e = data + BUNDLE_HEADER + i * BUNDLE_ENTRY;
+  const unsigned char *p = data + get_u32(e + 4);
+  return d2i_X509(NULL, &p, (long)get_u32(e + 8));
+}
+
+/**
+ * Order the entries by subject hash.
+ */
+static int cmp_entry(const void *a, const void *b)
+{
+  unsigned long ha = ((const t_bentry*)a)->hash;
+  unsigned long hb = ((const t_bentry*)b)->hash;
+  return (ha > hb) - (ha < hb);
+}
+
+#if defined(BUNDLE_LAZY)
+
+static X509_LOOKUP_METHOD *lookup_method = NULL;
+
+/**
+ * Release the mapped cache of a lookup.
+ */
+static void lookup_free(X509_LOOKUP *lu)
+{
+  t_fmap *m = (t_fmap*)X509_LOOKUP_get_method_data(lu);
+  if (m) {
+    fmap_close(m);
+    free(m);
+    X509_LOOKUP_set_method_data(lu, NULL);
+  }
+}
+
+/**
+ * Find the certificates with the subject name in the cache (binary search
+ * on the hash), decode them and add them to the store.
+ */
+static int lookup_by_subject(X509_LOOKUP *lu, X509_LOOKUP_TYPE type,
+  BUNDLE_NAME *name, X509_OBJECT *ret)
+{
+  X509 *cert;
+  X509_OBJECT *obj;
+  unsigned long lo, hi, mid, h;
+  int found = 0;
+  X509_STORE *store = X509_LOOKUP_get_store(lu);
+  t_fmap *m = (t_fmap*)X509_LOOKUP_get_method_data(lu);
+  if (!m || type != X509_LU_X509)
+    return 0;
+  h = X509_NAME_hash((X509_NAME*)name);
+  lo = 0;
+  hi = get_u32(m->data + BUNDLE_HEADER - 4);
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (get_u32(m->data + BUNDLE_HEADER + mid * BUNDLE_ENTRY) < h)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  hi = get_u32(m->data + BUNDLE_HEADER - 4);
+  for ( ; lo < hi && get_u32(m->data + BUNDLE_HEADER + lo*BUNDLE_ENTRY) == h;
+      lo++) {
+    cert = decode(m->data, lo);
+    if (!cert)
+      continue;
+    if (!X509_NAME_cmp(X509_get_subject_name(cert), name)) {
+      X509_STORE_add_cert(store, cert);
+      found = 1;
+    }
+    X509_free(cert);
+  }
+  if (!found)
+    return 0;
+  /* As the other lookups, return the object owned by the store without
+     a reference: the caller takes its own. */
+  X509_STORE_lock(store);
+  obj = X509_OBJECT_retrieve_by_subject(X509_STORE_get0_objects(store),
+    type, (X509_NAME*)name);
+  X509_STORE_unlock(store);
+  if (!obj || !X509_OBJECT_set1_X509(ret, X509_OBJECT_get0_X509(obj)))
+    return 0;
+  X509_free(X509_OBJECT_get0_X509(obj));
+  return 1;
+}
+
+/**
+ * Add the cache as a lookup of the store.
+ */
+static int attach(X509_STORE *store, t_fmap *m)
+{
+  X509_LOOKUP *lu;
+  t_fmap *data;
+  if (!lookup_method) {
+    lookup_method = X509_LOOKUP_meth_new("LuaSec CA bundle cache");
+    if (!lookup_method)
+      return 0;
+    X509_LOOKUP_meth_set_free(lookup_method, lookup_free);
+    X509_LOOKUP_meth_set_get_by_subject(lookup_method, lookup_by_subject);
+  }
+  data = (t_fmap*)malloc(sizeof(t_fmap));
+  if (!data)
+    return 0;
+  lu = X509_STORE_add_lookup(store, lookup_method);
+  if (!lu) {
+    free(data);
+    return 0;
+  }
+  lookup_free(lu);
+  *data = *m;
+  X509_LOOKUP_set_method_data(lu, data);
+  return 1;
+}
+
+#else
+
+/**
+ * Decode all certificates and add them to the store.
+ */
+static int attach(X509_STORE *store, t_fmap *m)
+{
+  X509 *cert;
+  unsigned long i;
+  unsigned long n = get_u32(m->data + BUNDLE_HEADER - 4);
+  for (i = 0; i < n; i++) {
+    cert = decode(m->data, i);
+    if (!cert) {
+      fmap_close(m);
+      return 0;
+    }
+    /* Duplicates are not an error */
+    X509_STORE_add_cert(store, cert);
+    X509_free(cert);
+  }
+  fmap_close(m);
+  return 1;
+}
+
+#endif
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Make the certificates of the binary cache available to the store, if
+ * the cache is up to date.
+ */
+int bundle_load(X509_STORE *store, const char *cafile, const char *cache)
+{
+  t_fmap m;
+  if (!open_cache(&m, cafile, cache))
+    return 0;
+#if defined(BUNDLE_LAZY)
+  if (!attach(store, &m)) {
+    fmap_close(&m);
+    return 0;
+  }
+  return 1;
+#else
+  return attach(store, &m);
+#endif
+}
+
+/**
+ * Create a temporary file next to the cache, with a name of its own:
+ * concurrent writers must not share the file they fill.
+ */
+static FILE *open_temp(const char *cache, char *tmp)
+{
+#if defined(_WIN32)
+  sprintf(tmp, "%s.%lu.tmp", cache, (unsigned long)_getpid());
+  return fopen(tmp, "wb");
+#else
+  FILE *fp;
+  int fd;
+  sprintf(tmp, "%s.XXXXXX", cache);
+  fd = mkstemp(tmp);
+  if (fd < 0)
+    return NULL;
+  /* Readable by the workers, like a file created by fopen() */
+  fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+  fp = fdopen(fd, "wb");
+  if (!fp) {
+    close(fd);
+    remove(tmp);
+  }
+  return fp;
+#endif
+}
+
+/**
+ * Parse the PEM bundle and write its binary cache. The cache is written
+ * to a temporary file and renamed, so readers never see a partial file.
+ * If 'store' is given, the certificates and CRLs of the bundle are also
+ * added to it. The cache is then written on a best effort basis: the
+ * result tells whether the store was filled.
+ */
+int bundle_compile(const char *cafile, const char *cache, X509_STORE *store)
+{
+  int i;
+  BIO *bio;
+  FILE *fp;
+  X509 *cert;
+  X509_INFO *info;
+  char *tmp = NULL;
+  t_bentry *entries = NULL;
+  STACK_OF(X509_INFO) *infos;
+  int ret = 0;
+  unsigned long n = 0;
+  unsigned long off;
+  unsigned char buf[BUNDLE_HEADER];
+  memcpy(buf, BUNDLE_MAGIC, 8);
+  if (!make_key(cafile, buf + 8))
+    return 0;
+  bio = BIO_new_file(cafile, "r");
+  if (!bio)
+    return 0;
+  infos = PEM_X509_INFO_read_bio(bio, NULL, NULL, NULL);
+  BIO_free(bio);
+  if (!infos)
+    return 0;
+  for (i = 0; store && i < sk_X509_INFO_num(infos); i++) {
+    info = sk_X509_INFO_value(infos, i);
+    if ((info->x509 && !X509_STORE_add_cert(store, info->x509)) ||
+        (info->crl && !X509_STORE_add_crl(store, info->crl))) {
+      sk_X509_INFO_pop_free(infos, X509_INFO_free);
+      return 0;
+    }
+  }
+  entries = (t_bentry*)calloc(sk_X509_INFO_num(infos) + 1, sizeof(t_bentry));
+  tmp = (char*)malloc(strlen(cache) + 32);
+  if (!entries || !tmp)
+    goto cleanup;
+  for (i = 0; i < sk_X509_INFO_num(infos); i++) {
+    cert = sk_X509_INFO_value(infos, i)->x509;
+    if (!cert)
+      continue;
+    entries[n].hash = X509_NAME_hash(X509_get_subject_name(cert));
+    entries[n].len = i2d_X509(cert, &entries[n].der);
+    if (entries[n].len <= 0)
+      goto cleanup;
+    n++;
+  }
+  qsort(entries, n, sizeof(t_bentry), cmp_entry);
+  fp = open_temp(cache, tmp);
+  if (!fp)
+    goto cleanup;
+  ret = 1;
+  put_u32(buf + BUNDLE_HEADER - 4, n);
+  if (fwrite(buf, 1, BUNDLE_HEADER, fp) != BUNDLE_HEADER)
+    ret = 0;
+  off = BUNDLE_HEADER + n * BUNDLE_ENTRY;
+  for (i = 0; ret && i < (int)n; i++) {
+    put_u32(buf, entries[i].hash);
+    put_u32(buf + 4, off);
+    put_u32(buf + 8, (unsigned long)entries[i].len);
+    if (fwrite(buf, 1, BUNDLE_ENTRY, fp) != BUNDLE_ENTRY)
+      ret = 0;
+    off += entries[i].len;
+  }
+  for (i = 0; ret && i < (int)n; i++) {
+    if (fwrite(entries[i].der, 1, entries[i].len, fp) != (size_t)entries[i].len)
+      ret = 0;
+  }
+  if (fclose(fp) != 0)
+    ret = 0;
+#if defined(_WIN32)
+  if (ret)
+    remove(cache);
+#endif
+  if (!ret || rename(tmp, cache) != 0) {
+    remove(tmp);
+    ret = 0;
+  }
+cleanup:
+  if (entries) {
+    for (i = 0; i < (int)n; i++)
+      OPENSSL_free(entries[i].der);
+    free(entries);
+  }
+  free(tmp);
+  sk_X509_INFO_pop_free(infos, X509_INFO_free);
+  return ret || store;
+}
@@ -0,0 +1,20 @@
+#ifndef __BUNDLE_H__
+#define __BUNDLE_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/x509.h>
+
+/* Make the certificates of 'cafile' available from its binary cache, if
+ * the cache is up to date. Return 1 on success, 0 if the cache must be
+ * rebuilt. */
+int bundle_load(X509_STORE *store, const char *cafile, const char *cache);
+/* Write the binary cache of the PEM bundle 'cafile', and add its
+ * certificates to 'store' if it is not NULL */
+int bundle_compile(const char *cafile, const char *cache, X509_STORE *store);
+
+#endif
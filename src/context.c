@@ -4,214 +4,2496 @@
  *
  *--------------------------------------------------------------------------*/
 
+#include <stdlib.h>
 #include <string.h>
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
 
 #include <lua.h>
 #include <lauxlib.h>
 
 #include "context.h"
 #include "options.h"
+#include "store.h"
+#include "crl.h"
+#include "ocsp.h"
+#include "key.h"
+#include "metrics.h"
+#include "timeout.h"
+#include "socket.h"
+#include "ssl.h"
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#elif defined(__linux__) && defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_STORE_CTX_get0_cert(c)  ((c)->cert)
+#endif
 
 /*--------------------------- Auxiliary Functions ----------------------------*/
 
 /**
- * Return the context.
+ * Return the context.
+ */
+static p_context checkctx(lua_State *L, int idx)
+{
+  return (p_context)luaL_checkudata(L, idx, "SSL:Context");
+}
+
+/**
+ * Return the context at 'idx', or NULL if the value is not a context.
+ */
+static p_context testctx(lua_State *L, int idx)
+{
+  p_context ctx = (p_context)lua_touserdata(L, idx);
+  if (ctx && lua_getmetatable(L, idx)) {
+    luaL_getmetatable(L, "SSL:Context");
+    if (!lua_rawequal(L, -1, -2))
+      ctx = NULL;
+    lua_pop(L, 2);
+    return ctx;
+  }
+  return NULL;
+}
+
+/**
+ * Keep the value at 'idx' referenced while the context is alive.
+ */
+static void ctx_setref(lua_State *L, p_context ctx, const char *field, int idx)
+{
+  lua_pushvalue(L, idx);
+  luaL_getmetatable(L, "SSL:Context:Registry");
+  lua_pushlightuserdata(L, (void*)ctx);
+  lua_rawget(L, -2);
+  if (lua_isnil(L, -1)) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushlightuserdata(L, (void*)ctx);
+    lua_pushvalue(L, -2);
+    lua_rawset(L, -4);
+  }
+  lua_pushvalue(L, -3);
+  lua_setfield(L, -2, field);
+  lua_pop(L, 3);
+}
+
+/**
+ * Push the value referenced by the context under 'field', or nil.
+ */
+static void ctx_pushref(lua_State *L, p_context ctx, const char *field)
+{
+  luaL_getmetatable(L, "SSL:Context:Registry");
+  lua_pushlightuserdata(L, (void*)ctx);
+  lua_rawget(L, -2);
+  if (lua_istable(L, -1))
+    lua_getfield(L, -1, field);
+  else
+    lua_pushnil(L);
+  lua_replace(L, -3);
+  lua_pop(L, 1);
+}
+
+/**
+ * Drop all values referenced by the context.
+ */
+static void ctx_clearrefs(lua_State *L, p_context ctx)
+{
+  luaL_getmetatable(L, "SSL:Context:Registry");
+  lua_pushlightuserdata(L, (void*)ctx);
+  lua_pushnil(L);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+}
+
+/**
+ * Prepare the SSL options flag.
+ */
+static int set_option_flag(const char *opt, unsigned long *flag)
+{
+  ssl_option_t *p;
+  for (p = ssl_options; p->name; p++) {
+    if (!strcmp(opt, p->name)) {
+      *flag |= p->code;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Find the protocol.
+ */
+const static SSL_METHOD* str2method(const char *method)
+{
+  if (!strcmp(method, "sslv3"))  return SSLv3_method();
+  if (!strcmp(method, "tlsv1"))  return TLSv1_method();
+  if (!strcmp(method, "sslv23")) return SSLv23_method();
+  return NULL;
+}
+
+/**
+ * Prepare the SSL handshake verify flag.
+ */
+static int set_verify_flag(const char *str, int *flag)
+{
+  if (!strcmp(str, "none")) { 
+    *flag |= SSL_VERIFY_NONE;
+    return 1;
+  }
+  if (!strcmp(str, "peer")) {
+    *flag |= SSL_VERIFY_PEER;
+    return 1;
+  }
+  if (!strcmp(str, "client_once")) {
+    *flag |= SSL_VERIFY_CLIENT_ONCE;
+    return 1;
+  }
+  if (!strcmp(str, "fail_if_no_peer_cert")) { 
+    *flag |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Prepare the certificate chain build flag.
+ */
+static int set_chain_flag(const char *str, unsigned long *flag)
+{
+#if defined(SSL_BUILD_CHAIN_FLAG_CHECK)
+  if (!strcmp(str, "check")) {
+    *flag |= SSL_BUILD_CHAIN_FLAG_CHECK;
+    return 1;
+  }
+  if (!strcmp(str, "no_root")) {
+    *flag |= SSL_BUILD_CHAIN_FLAG_NO_ROOT;
+    return 1;
+  }
+  if (!strcmp(str, "untrusted")) {
+    *flag |= SSL_BUILD_CHAIN_FLAG_UNTRUSTED;
+    return 1;
+  }
+  if (!strcmp(str, "ignore_error")) {
+    *flag |= SSL_BUILD_CHAIN_FLAG_IGNORE_ERROR;
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+/**
+ * Check if the CPU has AES instructions (AES-NI, ARMv8 AES).
+ * When it cannot be detected, assume it has.
+ */
+static int has_aes_hw(void)
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d))
+    return 1;
+  return (c & bit_AES) != 0;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  int info[4];
+  __cpuid(info, 1);
+  return (info[2] & (1 << 25)) != 0;
+#elif defined(__linux__) && defined(__aarch64__)
+  return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Password callback for reading the private key.
+ */
+static int passwd_cb(char *buf, int size, int flag, void *udata)
+{
+  lua_State *L = (lua_State*)udata;
+  switch (lua_type(L, 3)) {
+  case LUA_TFUNCTION:
+    lua_pushvalue(L, 3);
+    lua_call(L, 0, 1);
+    if (lua_type(L, -1) != LUA_TSTRING)
+       return 0;
+    /* fallback */
+  case LUA_TSTRING:
+    strncpy(buf, lua_tostring(L, -1), size);
+    buf[size-1] = '\0';
+    return (int)strlen(buf);
+  }
+  return 0;
+}
+
+/**
+ * Parse the certificates of a string: PEM, or concatenated DER.
+ */
+static STACK_OF(X509) *parse_certs(const char *data, size_t len)
+{
+  BIO *bio;
+  X509 *cert;
+  STACK_OF(X509) *certs;
+  const unsigned char *p = (const unsigned char*)data;
+  const unsigned char *end = p + len;
+  if (len > 0x7fffffff || !(certs = sk_X509_new_null()))
+    return NULL;
+  if (len > 0 && p[0] == 0x30) {
+    while (p < end && (cert = d2i_X509(NULL, &p, (long)(end - p))) != NULL) {
+      if (!sk_X509_push(certs, cert)) {
+        X509_free(cert);
+        break;
+      }
+    }
+    if (p == end)
+      return certs;
+    sk_X509_pop_free(certs, X509_free);
+    return NULL;
+  }
+  bio = BIO_new_mem_buf((void*)data, (int)len);
+  if (!bio) {
+    sk_X509_free(certs);
+    return NULL;
+  }
+  while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+    if (!sk_X509_push(certs, cert)) {
+      X509_free(cert);
+      break;
+    }
+  }
+  BIO_free(bio);
+  /* The end of the data is reported as an error */
+  if (sk_X509_num(certs) > 0)
+    ERR_clear_error();
+  return certs;
+}
+
+#if defined(PROVIDER_ENABLED)
+static int cert_cb(SSL *ssl, void *arg);
+#endif
+
+/**
+ * Move a connection to another context.
+ */
+static void switch_context(SSL *ssl, p_context target)
+{
+  if (target->context != SSL_get_SSL_CTX(ssl)) {
+    /* Keep following the handshake in progress */
+    if (!SSL_get_info_callback(ssl))
+      SSL_set_info_callback(ssl,
+        SSL_CTX_get_info_callback(SSL_get_SSL_CTX(ssl)));
+    SSL_set_SSL_CTX(ssl, target->context);
+    /* SSL_set_SSL_CTX() does not change the verification settings */
+    SSL_set_verify(ssl, SSL_CTX_get_verify_mode(target->context),
+      SSL_CTX_get_verify_callback(target->context));
+    SSL_set_verify_depth(ssl, SSL_CTX_get_verify_depth(target->context));
+    SSL_clear_options(ssl, SSL_get_options(ssl) &
+      ~SSL_CTX_get_options(target->context));
+    SSL_set_options(ssl, SSL_CTX_get_options(target->context));
+#if defined(GOVERNOR_ENABLED)
+    /* The governor still decides if the session is not resumed */
+    SSL_set_cert_cb(ssl, cert_cb, (void*)target);
+#endif
+  }
+}
+
+/**
+ * Server name callback: switch the connection to the context mapped to
+ * the name sent by the client.
+ */
+static int servername_cb(SSL *ssl, int *ad, void *arg)
+{
+  p_context target;
+  p_context ctx = (p_context)arg;
+  p_sni sni = ctx->sni;
+  const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (!name || !sni)
+    return SSL_TLSEXT_ERR_NOACK;
+  target = (p_context)sni_lookup(sni, name);
+  if (!target) {
+    /* Unknown names may still be resolved by the certificate provider */
+    if (sni->strict && !ctx->provider) {
+      *ad = SSL_AD_UNRECOGNIZED_NAME;
+      return SSL_TLSEXT_ERR_ALERT_FATAL;
+    }
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  switch_context(ssl, target);
+  return SSL_TLSEXT_ERR_OK;
+}
+
+/**
+ * Release the server name dispatcher.
+ */
+static void free_sni(p_context ctx)
+{
+  if (ctx->sni) {
+    sni_free(ctx->sni);
+    free(ctx->sni);
+    ctx->sni = NULL;
+  }
+}
+
+/**
+ * Return the Lua thread running the connection, where the callbacks call
+ * the Lua functions of the context, or NULL.
+ */
+static lua_State *ssl_getstate(SSL *ssl)
+{
+  p_ssl conn = (p_ssl)SSL_get_app_data(ssl);
+  return conn ? conn->L : NULL;
+}
+
+#if defined(PROVIDER_ENABLED)
+/**
+ * Ask the Lua loader for the context of a server name.
+ * Return a new reference to the context, or NULL.
+ */
+static SSL_CTX *provider_loadlua(p_context ctx, lua_State *L,
+  const char *name)
+{
+  int top;
+  p_context sub;
+  SSL_CTX *loaded = NULL;
+  if (!L) {
+    ctx->provider->failures++;
+    return NULL;
+  }
+  top = lua_gettop(L);
+  ctx_pushref(L, ctx, "provider");
+  if (lua_isfunction(L, -1)) {
+    lua_pushstring(L, name);
+    if (lua_pcall(L, 1, 1, 0) != 0)
+      ctx->provider->failures++;
+    else if ((sub = testctx(L, -1)) != NULL && sub->context) {
+      loaded = sub->context;
+      SSL_CTX_up_ref(loaded);
+    }
+  }
+  lua_settop(L, top);
+  return loaded;
+}
+
+/**
+ * Certificate callback, only run by handshakes that are not resumed:
+ * charge the governor for the clients admitted as resumable, then
+ * install the certificate of the server name from the provider, loading
+ * it on a miss. In asynchronous mode a miss suspends the handshake until
+ * the application calls provide().
+ */
+static int cert_cb(SSL *ssl, void *arg)
+{
+  int ret;
+  p_provent e;
+  SSL_CTX *loaded;
+  p_context ctx = (p_context)arg;
+  p_provider p = ctx->provider;
+  int fallback = !(ctx->sni && ctx->sni->strict);
+  const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  p_ssl conn = (p_ssl)SSL_get_app_data(ssl);
+#if defined(GOVERNOR_ENABLED)
+  if ((ret = governor_full(ssl)) != 1)
+    return ret;
+#endif
+  /* The client hello function already picked the certificate */
+  if (!p || !name || (conn && conn->certchosen))
+    return 1;
+  e = provider_get(p, name);
+  if (e)
+    return e->context ? provider_use(ssl, e->context) : fallback;
+  if (p->async)
+    return -1;
+  if (p->dir)
+    loaded = provider_loaddir(p, name);
+  else
+    loaded = provider_loadlua(ctx, ssl_getstate(ssl), name);
+  provider_put(p, name, loaded);
+  if (!loaded)
+    return fallback;
+  ret = provider_use(ssl, loaded);
+  SSL_CTX_free(loaded);
+  return ret;
+}
+#endif
+
+/**
+ * Release the certificate provider.
+ */
+static void free_provider(p_context ctx)
+{
+  if (ctx->provider) {
+#if defined(PROVIDER_ENABLED)
+    provider_free(ctx->provider);
+#endif
+    free(ctx->provider);
+    ctx->provider = NULL;
+  }
+}
+
+/**
+ * Check the peer certificates against the indexed CRLs: the verified
+ * chain, or the certificates sent by the peer when no chain was built.
+ */
+static int check_revoked(p_context ctx, X509_STORE_CTX *x509ctx)
+{
+#if defined(CRL_ENABLED)
+  int i;
+  int err = X509_V_OK;
+  X509 *cert;
+  STACK_OF(X509) *chain;
+  if (!ctx->crl)
+    return 1;
+  cert = X509_STORE_CTX_get0_cert(x509ctx);
+  chain = X509_STORE_CTX_get0_chain(x509ctx);
+  if (!chain || sk_X509_num(chain) == 0) {
+    if (cert && (err = crl_revoked(ctx->crl, cert)) != X509_V_OK)
+      goto failed;
+    chain = X509_STORE_CTX_get0_untrusted(x509ctx);
+  }
+  for (i = 0; i < sk_X509_num(chain); i++) {
+    cert = sk_X509_value(chain, i);
+    if ((err = crl_revoked(ctx->crl, cert)) != X509_V_OK)
+      goto failed;
+  }
+  return 1;
+failed:
+  X509_STORE_CTX_set_current_cert(x509ctx, cert);
+  X509_STORE_CTX_set_error(x509ctx, err);
+  return 0;
+#else
+  return 1;
+#endif
+}
+
+/**
+ * Verify the peer certificate chain. A peer whose key is pinned, or a
+ * leaf found in the verification cache, skips the chain building and the
+ * signature checks.
+ */
+static int verify_cb(X509_STORE_CTX *x509ctx, void *arg)
+{
+  int ret;
+  p_context ctx = (p_context)arg;
+  X509 *cert = X509_STORE_CTX_get0_cert(x509ctx);
+  X509_STORE *store = SSL_CTX_get_cert_store(ctx->context);
+  unsigned long generation = ctx->store ? ctx->store->generation : 0;
+  if (ctx->pins) {
+    if (!cert || !pins_check(ctx->pins, cert)) {
+      X509_STORE_CTX_set_error(x509ctx, X509_V_ERR_CERT_REJECTED);
+      return 0;
+    }
+    if (!ctx->pins->chain)
+      return check_revoked(ctx, x509ctx);
+  }
+  if (ctx->vcache && cert &&
+      vcache_check(ctx->vcache, cert, store, generation))
+    return check_revoked(ctx, x509ctx);
+  ret = X509_verify_cert(x509ctx);
+  if (ret > 0 && ctx->vcache && cert &&
+      X509_STORE_CTX_get_error(x509ctx) == X509_V_OK)
+    vcache_add(ctx->vcache, cert, store, generation);
+  return ret > 0 ? check_revoked(ctx, x509ctx) : ret;
+}
+
+/**
+ * Check the OCSP status of the server certificate, stapled or cached.
+ * A revoked certificate or an invalid response fails the handshake; a
+ * missing or unknown status only if a status is required.
+ */
+static int status_cb(SSL *ssl, void *arg)
+{
+  p_context ctx = (p_context)arg;
+  switch (ocsp_check(ctx->ocsp, ssl)) {
+  case OCSP_CHECK_GOOD:
+    return 1;
+  case OCSP_CHECK_NONE:
+  case OCSP_CHECK_UNKNOWN:
+    return !ctx->ocsprequired;
+  case OCSP_CHECK_REVOKED:
+    SSL_set_verify_result(ssl, X509_V_ERR_CERT_REVOKED);
+    return 0;
+  }
+  return 0;
+}
+
+/**
+ * Release the verification cache.
+ */
+static void free_vcache(p_context ctx)
+{
+  if (ctx->vcache) {
+    vcache_free(ctx->vcache);
+    free(ctx->vcache);
+    ctx->vcache = NULL;
+  }
+}
+
+/**
+ * Release the pin set.
+ */
+static void free_pins(p_context ctx)
+{
+  if (ctx->pins) {
+    pins_free(ctx->pins);
+    free(ctx->pins);
+    ctx->pins = NULL;
+  }
+}
+
+/**
+ * Stop sharing the trust store, the context gets an empty one.
+ */
+static void detach_store(lua_State *L, p_context ctx)
+{
+  if (ctx->vcache)
+    vcache_flush(ctx->vcache);
+  if (ctx->store) {
+    store_detach(ctx->store, ctx->context);
+    ctx->store = NULL;
+    SSL_CTX_set_cert_store(ctx->context, X509_STORE_new());
+    lua_pushnil(L);
+    ctx_setref(L, ctx, "store", -1);
+    lua_pop(L, 1);
+  }
+}
+
+/**
+ * Key identifying the destination of a client connection: the server
+ * name, if set, or the peer address. Return the key length, or 0.
+ */
+static size_t ssl_destkey(SSL *ssl, char *buf, size_t size)
+{
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+  const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (name) {
+    size_t n = strlen(name);
+    if (n + 1 > size)
+      n = size - 1;
+    buf[0] = 'n';
+    memcpy(buf + 1, name, n);
+    return n + 1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  if (getpeername(SSL_get_fd(ssl), (struct sockaddr*)&addr, &len) != 0 ||
+      (size_t)len + 1 > size)
+    return 0;
+  buf[0] = 'a';
+  memcpy(buf + 1, &addr, len);
+  return (size_t)len + 1;
+}
+
+/**
+ * Time the phases of the handshakes, for the contexts that ask for it.
+ * The end is added to the histograms of the context that served the
+ * connection.
+ */
+static void info_timing(SSL *ssl, p_context ctx, int where)
+{
+  p_ssl conn = (p_ssl)SSL_get_app_data(ssl);
+  if (!conn)
+    return;
+  if ((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(ssl)) {
+    if (ctx && ctx->timing)
+      timing_start(&conn->phases);
+  } else if (where & SSL_CB_HANDSHAKE_DONE) {
+    timing_done(&conn->phases, ctx ? ctx->timing : NULL,
+      SSL_session_reused(ssl));
+  }
+}
+
+/**
+ * Handshake state callback, shared by the per-connection features.
+ */
+static void info_cb(const SSL *cssl, int where, int ret)
+{
+  size_t len;
+  char key[SNI_MAXNAME + 2];
+  SSL *ssl = (SSL*)cssl;
+  p_context ctx = (p_context)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  info_timing(ssl, ctx, where);
+  if (SSL_is_server(ssl)) {
+#if defined(GOVERNOR_ENABLED)
+    /* The full handshake is over, done or failed */
+    if ((where & SSL_CB_HANDSHAKE_DONE) ||
+        ((where & SSL_CB_ALERT) && (ret >> 8) == SSL3_AL_FATAL))
+      governor_release(ssl);
+#endif
+    return;
+  }
+  if (!ctx)
+    return;
+  /* TLS 1.3 post-handshake messages also start a "handshake" */
+  if ((where & SSL_CB_HANDSHAKE_START) && SSL_in_before(ssl)) {
+    if ((len = ssl_destkey(ssl, key, sizeof(key))) == 0)
+      return;
+#if defined(TICKETS_ENABLED)
+    /* A session set by the application has precedence */
+    if (ctx->tickets && !SSL_get_session(ssl)) {
+      SSL_SESSION *sess = tickets_get(ctx->tickets, key, len);
+      if (sess) {
+        SSL_set_session(ssl, sess);
+        SSL_SESSION_free(sess);
+      }
+    }
+#endif
+#if defined(KEYSHARE_ENABLED)
+    if (ctx->keyshare)
+      keyshare_apply(ctx->keyshare, ssl, key, len);
+#endif
+  } else if (where & SSL_CB_HANDSHAKE_DONE) {
+#if defined(KEYSHARE_ENABLED)
+    if (ctx->keyshare && (len = ssl_destkey(ssl, key, sizeof(key))) > 0)
+      keyshare_learn(ctx->keyshare, ssl, key, len);
+#endif
+  }
+}
+
+/**
+ * Protocol message callback: time the handshake messages and count the
+ * HelloRetryRequests received.
+ */
+static void msg_cb(int write_p, int version, int content_type,
+                   const void *buf, size_t len, SSL *ssl, void *arg)
+{
+  p_ssl conn;
+#if defined(KEYSHARE_ENABLED)
+  p_context ctx = (p_context)arg;
+#endif
+  if (content_type != SSL3_RT_HANDSHAKE)
+    return;
+  conn = (p_ssl)SSL_get_app_data(ssl);
+  if (conn)
+    timing_message(&conn->phases, buf, len);
+#if defined(KEYSHARE_ENABLED)
+  if (!write_p && ctx->keyshare && keyshare_ishrr(buf, len))
+    ctx->keyshare->hrr++;
+#endif
+}
+
+/**
+ * Release the key share memory.
+ */
+static void free_keyshare(p_context ctx)
+{
+  if (ctx->keyshare) {
+#if defined(KEYSHARE_ENABLED)
+    keyshare_free(ctx->keyshare);
+#endif
+    free(ctx->keyshare);
+    ctx->keyshare = NULL;
+  }
+  free(ctx->groups);
+  ctx->groups = NULL;
+}
+
+/**
+ * Release the pre-shared keys.
+ */
+static void free_psk(p_context ctx)
+{
+  if (ctx->psk) {
+    psk_free(ctx->psk);
+    free(ctx->psk);
+    ctx->psk = NULL;
+  }
+}
+
+#if defined(PSK_ENABLED)
+/**
+ * Client: the identity and key to use, from the Lua function if one was
+ * given (called with the server hint), else the static pair.
+ */
+static p_pskey psk_client_key(p_context ctx, lua_State *L, const char *hint)
+{
+  int top;
+  size_t idlen, keylen;
+  const char *id, *key;
+  p_psk p = ctx->psk;
+  if (!L) {
+    p->misses++;
+    return NULL;
+  }
+  top = lua_gettop(L);
+  ctx_pushref(L, ctx, "psk");
+  if (lua_isfunction(L, -1)) {
+    p->key.len = 0;
+    if (hint)
+      lua_pushstring(L, hint);
+    else
+      lua_pushnil(L);
+    if (lua_pcall(L, 1, 2, 0) == 0 &&
+        (id = lua_tolstring(L, -2, &idlen)) != NULL &&
+        (key = lua_tolstring(L, -1, &keylen)) != NULL)
+      psk_set(p, id, idlen, key, keylen);
+  }
+  lua_settop(L, top);
+  if (p->key.len == 0) {
+    p->misses++;
+    return NULL;
+  }
+  p->hits++;
+  return &p->key;
+}
+
+/**
+ * Server: the key of an identity, from the table or the Lua function.
+ */
+static p_pskey psk_server_key(p_context ctx, lua_State *L, const char *id,
+  size_t idlen)
+{
+  int top;
+  size_t keylen;
+  const char *key;
+  p_psk p = ctx->psk;
+  p_pskey k = psk_find(p, id, idlen);
+  if (!k && L) {
+    top = lua_gettop(L);
+    ctx_pushref(L, ctx, "psk");
+    if (lua_isfunction(L, -1)) {
+      lua_pushlstring(L, id, idlen);
+      if (lua_pcall(L, 1, 1, 0) == 0 &&
+          (key = lua_tolstring(L, -1, &keylen)) != NULL &&
+          keylen > 0 && keylen <= PSK_MAX_PSK_LEN) {
+        memcpy(p->key.data, key, keylen);
+        p->key.len = keylen;
+        k = &p->key;
+      }
+    }
+    lua_settop(L, top);
+  }
+  if (k)
+    p->hits++;
+  else
+    p->misses++;
+  return k;
+}
+
+/**
+ * Context of the connection, if it has pre-shared keys.
+ */
+static p_context psk_getctx(SSL *ssl)
+{
+  p_context ctx = (p_context)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  return (ctx && ctx->psk) ? ctx : NULL;
+}
+
+/**
+ * TLS 1.2 PSK cipher suites, client side.
+ */
+static unsigned int psk_client_cb(SSL *ssl, const char *hint, char *identity,
+  unsigned int max_identity_len, unsigned char *psk, unsigned int max_psk_len)
+{
+  p_pskey k;
+  p_context ctx = psk_getctx(ssl);
+  if (!ctx || !(k = psk_client_key(ctx, ssl_getstate(ssl), hint)))
+    return 0;
+  if (strlen(ctx->psk->identity) >= max_identity_len || k->len > max_psk_len)
+    return 0;
+  strcpy(identity, ctx->psk->identity);
+  memcpy(psk, k->data, k->len);
+  return (unsigned int)k->len;
+}
+
+/**
+ * TLS 1.2 PSK cipher suites, server side.
+ */
+static unsigned int psk_server_cb(SSL *ssl, const char *identity,
+  unsigned char *psk, unsigned int max_psk_len)
+{
+  p_pskey k;
+  p_context ctx = psk_getctx(ssl);
+  if (!ctx || !identity ||
+      !(k = psk_server_key(ctx, ssl_getstate(ssl), identity,
+                           strlen(identity))) ||
+      k->len > max_psk_len)
+    return 0;
+  memcpy(psk, k->data, k->len);
+  return (unsigned int)k->len;
+}
+
+#if defined(PSK_TLS13)
+/**
+ * TLS 1.3 external PSK, client side. Without a key the handshake goes on
+ * with certificates.
+ */
+static int psk_use_session_cb(SSL *ssl, const EVP_MD *md,
+  const unsigned char **id, size_t *idlen, SSL_SESSION **sess)
+{
+  p_pskey k;
+  SSL_SESSION *s;
+  p_context ctx = psk_getctx(ssl);
+  *sess = NULL;
+  if (!ctx || !(k = psk_client_key(ctx, ssl_getstate(ssl), NULL)))
+    return 1;
+  s = psk_session(ssl, k);
+  if (!s)
+    return 0;
+  /* After a HelloRetryRequest, the hash must match the chosen suite */
+  if (md && md != SSL_CIPHER_get_handshake_digest(SSL_SESSION_get0_cipher(s))) {
+    SSL_SESSION_free(s);
+    return 1;
+  }
+  *id = (const unsigned char*)ctx->psk->identity;
+  *idlen = strlen(ctx->psk->identity);
+  *sess = s;
+  return 1;
+}
+
+/**
+ * TLS 1.3 external PSK, server side.
+ */
+static int psk_find_session_cb(SSL *ssl, const unsigned char *id,
+  size_t idlen, SSL_SESSION **sess)
+{
+  p_pskey k;
+  p_context ctx = psk_getctx(ssl);
+  *sess = NULL;
+  if (!ctx ||
+      !(k = psk_server_key(ctx, ssl_getstate(ssl), (const char*)id, idlen)))
+    return 1;
+  *sess = psk_session(ssl, k);
+  return *sess != NULL;
+}
+#endif
+#endif
+
+#if defined(TICKETS_ENABLED)
+/**
+ * Client: keep the sessions (tickets) sent by the server, by destination.
+ */
+static int new_session_cb(SSL *ssl, SSL_SESSION *sess)
+{
+  size_t len;
+  char key[SNI_MAXNAME + 2];
+  p_context ctx = (p_context)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  if (!ctx || !ctx->tickets || (len = ssl_destkey(ssl, key, sizeof(key))) == 0)
+    return 0;
+  return tickets_put(ctx->tickets, key, len, sess);
+}
+#endif
+
+/**
+ * Release the client session store.
+ */
+static void free_tickets(p_context ctx)
+{
+  if (ctx->tickets) {
+#if defined(TICKETS_ENABLED)
+    tickets_free(ctx->tickets);
+#endif
+    free(ctx->tickets);
+    ctx->tickets = NULL;
+  }
+}
+
+#if defined(HELLO_ENABLED)
+/**
+ * ClientHello callback: the checks in C first, then the Lua function,
+ * which gets a table describing the hello and returns false to reject
+ * it, a context to switch to, or a context and "certificate" to use only
+ * its certificates. All before any key exchange or signature.
+ */
+static int hello_cb(SSL *ssl, int *al, void *arg)
+{
+  int top;
+  p_context target;
+  char name[SNI_MAXNAME + 1];
+  p_context ctx = (p_context)arg;
+  p_hello h = ctx->hello;
+  lua_State *L = ssl_getstate(ssl);
+  int ret = SSL_CLIENT_HELLO_SUCCESS;
+#if defined(GOVERNOR_ENABLED)
+  if (ctx->governor) {
+    ret = governor_admit(ctx->governor, ssl, ctx->context, al);
+    if (ret != SSL_CLIENT_HELLO_SUCCESS)
+      return ret;
+    /* Follow the connection even if SNI switches its context */
+    SSL_set_info_callback(ssl, info_cb);
+  }
+#endif
+  if (!h)
+    return ret;
+  if (h->requiresni && !hello_servername(ssl, name)) {
+    h->rejected++;
+    *al = SSL_AD_UNRECOGNIZED_NAME;
+    return SSL_CLIENT_HELLO_ERROR;
+  }
+  if (h->minversion && hello_maxversion(ssl) < h->minversion) {
+    h->rejected++;
+    *al = SSL_AD_PROTOCOL_VERSION;
+    return SSL_CLIENT_HELLO_ERROR;
+  }
+  /* No running call to decide: refuse rather than skip the function */
+  if (!L) {
+    h->failures++;
+    *al = SSL_AD_INTERNAL_ERROR;
+    return SSL_CLIENT_HELLO_ERROR;
+  }
+  top = lua_gettop(L);
+  ctx_pushref(L, ctx, "clienthello");
+  if (lua_isfunction(L, -1)) {
+    hello_push(L, ssl);
+    if (lua_pcall(L, 1, 2, 0) != 0) {
+      h->failures++;
+      *al = SSL_AD_INTERNAL_ERROR;
+      ret = SSL_CLIENT_HELLO_ERROR;
+    } else if (lua_isboolean(L, -2) && !lua_toboolean(L, -2)) {
+      h->rejected++;
+      *al = SSL_AD_HANDSHAKE_FAILURE;
+      ret = SSL_CLIENT_HELLO_ERROR;
+    } else if ((target = testctx(L, -2)) != NULL && target->context) {
+      if (lua_type(L, -1) == LUA_TSTRING &&
+          !strcmp(lua_tostring(L, -1), "certificate")) {
+        if (!provider_use(ssl, target->context)) {
+          *al = SSL_AD_INTERNAL_ERROR;
+          ret = SSL_CLIENT_HELLO_ERROR;
+        } else
+          ((p_ssl)SSL_get_app_data(ssl))->certchosen = 1;
+      } else
+        switch_context(ssl, target);
+      h->switched++;
+    }
+  }
+  lua_settop(L, top);
+  if (ret == SSL_CLIENT_HELLO_SUCCESS)
+    h->accepted++;
+  return ret;
+}
+#endif
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Create a SSL context.
+ */
+static int create(lua_State *L)
+{
+  p_context ctx;
+  const SSL_METHOD *method;
+
+  method = str2method(luaL_checkstring(L, 1));
+  if (!method) {
+    lua_pushnil(L);
+    lua_pushstring(L, "invalid protocol");
+    return 2;
+  }
+  ctx = (p_context) lua_newuserdata(L, sizeof(t_context));
+  if (!ctx) {
+    lua_pushnil(L);
+    lua_pushstring(L, "error creating context");
+    return 2;
+  }  
+  ctx->context = SSL_CTX_new(method);
+  if (!ctx->context) {
+    lua_pushnil(L);
+    lua_pushstring(L, "error creating context");
+    return 2;
+  }
+  ctx->mode = MD_CTX_INVALID;
+  ctx->sni = NULL;
+  ctx->provider = NULL;
+  ctx->store = NULL;
+  ctx->vcache = NULL;
+  ctx->pins = NULL;
+  ctx->crl = NULL;
+  ctx->ocsp = NULL;
+  ctx->ocsprequired = 0;
+  ctx->keyshare = NULL;
+  ctx->groups = NULL;
+  ctx->psk = NULL;
+  ctx->tickets = NULL;
+  ctx->hello = NULL;
+  ctx->governor = NULL;
+  ctx->certsize = 0;
+  memset(ctx->certcomp, 0, sizeof(ctx->certcomp));
+  ctx->certalgs = 0;
+  ctx->reloads = 0;
+  ctx->reloadfailures = 0;
+  ctx->reloadtime = 0;
+  ctx->reloadmax = 0;
+  memset(&ctx->io, 0, sizeof(t_iostats));
+  ctx->ioclosed = 0;
+  ctx->timing = NULL;
+  ctx->latency = NULL;
+  ctx->metrics = NULL;
+  SSL_CTX_set_app_data(ctx->context, ctx);
+  luaL_getmetatable(L, "SSL:Context");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/**
+ * Load the trusting certificates.
+ */
+static int load_locations(lua_State *L)
+{
+  p_context c = checkctx(L, 1);
+  SSL_CTX *ctx = c->context;
+  const char *cafile = luaL_optstring(L, 2, NULL);
+  const char *capath = luaL_optstring(L, 3, NULL);
+  /* Do not change a store shared with other contexts */
+  detach_store(L, c);
+  if (SSL_CTX_load_verify_locations(ctx, cafile, capath) != 1) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading CA locations (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Use a trust store (ssl.store) shared with other contexts.
+ */
+static int set_store(lua_State *L)
+{
+  p_context ctx = checkctx(L, 1);
+  p_store st = store_getstore(L, 2);
+  detach_store(L, ctx);
+  if (!store_attach(st, ctx->context)) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error attaching trust store");
+    return 2;
+  }
+  ctx->store = st;
+  ctx_setref(L, ctx, "store", 2);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Cache successful peer verifications: at most 'maxentries' leaf
+ * certificates, each for 'ttl' seconds. A size of 0 disables the cache.
+ */
+static int set_verify_cache(lua_State *L)
+{
+  p_vcache vc;
+  p_context ctx = checkctx(L, 1);
+  size_t maxentries = (size_t)luaL_checknumber(L, 2);
+  long ttl = luaL_optlong(L, 3, 300);
+  free_vcache(ctx);
+  if (maxentries == 0) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  vc = (p_vcache)malloc(sizeof(t_vcache));
+  if (!vc || !vcache_init(vc, maxentries, ttl)) {
+    free(vc);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating verification cache");
+    return 2;
+  }
+  ctx->vcache = vc;
+  SSL_CTX_set_cert_verify_callback(ctx->context, verify_cb, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Check the peer certificates against a set of indexed CRLs (ssl.crl),
+ * shared with other contexts; nil stops the checks.
+ */
+static int set_crl(lua_State *L)
+{
+  p_context ctx = checkctx(L, 1);
+  if (lua_isnoneornil(L, 2)) {
+    ctx->crl = NULL;
+    lua_pushnil(L);
+    ctx_setref(L, ctx, "crl", -1);
+    lua_pop(L, 1);
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  ctx->crl = crl_getcrl(L, 2);
+  ctx_setref(L, ctx, "crl", 2);
+  SSL_CTX_set_cert_verify_callback(ctx->context, verify_cb, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Request the OCSP status of the server certificate (stapling) and check
+ * it, caching the verified statuses in an ssl.ocsp shared with other
+ * contexts. Servers that do not staple use the cached status, if any.
+ * With 'required', the handshake fails without a good status. nil stops
+ * the requests.
+ */
+static int set_ocsp(lua_State *L)
+{
+  p_context ctx = checkctx(L, 1);
+  if (lua_isnoneornil(L, 2)) {
+    ctx->ocsp = NULL;
+    lua_pushnil(L);
+    ctx_setref(L, ctx, "ocsp", -1);
+    lua_pop(L, 1);
+    SSL_CTX_set_tlsext_status_cb(ctx->context, NULL);
+    SSL_CTX_set_tlsext_status_arg(ctx->context, NULL);
+#if defined(OCSP_ENABLED)
+    SSL_CTX_set_tlsext_status_type(ctx->context, -1);
+#endif
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  if (ctx->mode != MD_CTX_CLIENT) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "OCSP status checks need a client context");
+    return 2;
+  }
+  ctx->ocsp = ocsp_getcache(L, 2);
+  ctx->ocsprequired = lua_toboolean(L, 3);
+  ctx_setref(L, ctx, "ocsp", 2);
+#if defined(OCSP_ENABLED)
+  SSL_CTX_set_tlsext_status_type(ctx->context, TLSEXT_STATUSTYPE_ocsp);
+#endif
+  SSL_CTX_set_tlsext_status_cb(ctx->context, status_cb);
+  SSL_CTX_set_tlsext_status_arg(ctx->context, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Accept the peer only if the SHA-256 of its public key (SPKI) is in the
+ * list of pins: raw digests, hex, or base64 with an optional "sha256/"
+ * prefix. Unless 'chain' is true, the chain is not verified against the
+ * CAs. Turns on the peer verification.
+ */
+static int set_pins(lua_State *L)
+{
+  size_t i, n, len;
+  const char *pin;
+  p_context ctx = checkctx(L, 1);
+  int chain = lua_toboolean(L, 3);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  free_pins(ctx);
+  ctx->pins = (p_pins)malloc(sizeof(t_pins));
+  if (!ctx->pins || !pins_init(ctx->pins, chain)) {
+    free(ctx->pins);
+    ctx->pins = NULL;
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating pin set");
+    return 2;
+  }
+  n = lua_objlen(L, 2);
+  for (i = 1; i <= n; i++) {
+    lua_rawgeti(L, 2, (int)i);
+    pin = lua_tolstring(L, -1, &len);
+    if (!pin || !pins_add(ctx->pins, pin, len)) {
+      free_pins(ctx);
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "invalid pin #%d", (int)i);
+      return 2;
+    }
+    lua_pop(L, 1);
+  }
+  SSL_CTX_set_verify(ctx->context,
+    SSL_CTX_get_verify_mode(ctx->context) | SSL_VERIFY_PEER,
+    SSL_CTX_get_verify_callback(ctx->context));
+  SSL_CTX_set_cert_verify_callback(ctx->context, verify_cb, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Load the certificate file -- the leaf followed by its intermediates.
+ * Certificates with different key types (RSA, ECDSA, Ed25519) can be
+ * loaded in the same context, each one after its key; OpenSSL picks one
+ * per handshake from the signature algorithms of the peer.
+ */
+static int load_cert(lua_State *L)
+{
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *filename = luaL_checkstring(L, 2);
+  if (SSL_CTX_use_certificate_chain_file(ctx, filename) != 1) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading certificate (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Build and verify the certificate chain sent to the peer, once, at load
+ * time. The result is cached in the context and automatic chain building
+ * is turned off, so handshakes only copy the prebuilt chain.
+ */
+static int build_chain(lua_State *L)
+{
+#if defined(SSL_BUILD_CHAIN_FLAG_CHECK)
+  int i;
+  unsigned long flag = 0L;
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  int max = lua_gettop(L);
+  for (i = 2; i <= max; i++) {
+    if (!set_chain_flag(luaL_checkstring(L, i), &flag)) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "invalid chain option");
+      return 2;
+    }
+  }
+  ERR_clear_error();
+  /* Build the chain of each certificate (RSA, ECDSA, ...) */
+  i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+  for ( ; i; i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+    if (SSL_CTX_build_cert_chain(ctx, flag) <= 0) {
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "error building certificate chain (%s)",
+        ERR_reason_error_string(ERR_get_error()));
+      return 2;
+    }
+  }
+  SSL_CTX_set_mode(ctx, SSL_MODE_NO_AUTO_CHAIN);
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "certificate chain building not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Load the key file -- only in PEM format -- or use a key object
+ * (ssl.key) parsed once for several contexts.
+ */
+static int load_key(lua_State *L)
+{
+  int ret = 1;
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *filename;
+  if (lua_isuserdata(L, 2)) {
+    p_key key = key_getkey(L, 2);
+    if (SSL_CTX_use_PrivateKey(ctx, key->pkey) != 1) {
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "error loading private key (%s)",
+        ERR_reason_error_string(ERR_get_error()));
+      return 2;
+    }
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  filename = luaL_checkstring(L, 2);
+  switch (lua_type(L, 3)) {
+  case LUA_TSTRING:
+  case LUA_TFUNCTION:
+    SSL_CTX_set_default_passwd_cb(ctx, passwd_cb);
+    SSL_CTX_set_default_passwd_cb_userdata(ctx, L);
+    /* fallback */
+  case LUA_TNIL: 
+    if (SSL_CTX_use_PrivateKey_file(ctx, filename, SSL_FILETYPE_PEM) == 1)
+      lua_pushboolean(L, 1);
+    else {
+      ret = 2;
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "error loading private key (%s)",
+        ERR_reason_error_string(ERR_get_error()));
+    }
+    SSL_CTX_set_default_passwd_cb(ctx, NULL);
+    SSL_CTX_set_default_passwd_cb_userdata(ctx, NULL);
+    break;
+  default:
+    lua_pushstring(L, "invalid callback value");
+    lua_error(L);
+  }
+  return ret;
+}
+
+/**
+ * Load the private key from a string, PEM or DER. The password is a
+ * string or a function, as in loadkey().
+ */
+static int load_key_data(lua_State *L)
+{
+  size_t len;
+  EVP_PKEY *pkey;
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *data = luaL_checklstring(L, 2, &len);
+  pkey = key_parse(L, data, len, 3);
+  if (!pkey || SSL_CTX_use_PrivateKey(ctx, pkey) != 1) {
+    EVP_PKEY_free(pkey);
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading private key (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  EVP_PKEY_free(pkey);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Load the certificate from a string -- the leaf followed by its
+ * intermediates, PEM or concatenated DER.
+ */
+static int load_cert_data(lua_State *L)
+{
+  size_t len;
+  int ok;
+  X509 *cert;
+  STACK_OF(X509) *certs;
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *data = luaL_checklstring(L, 2, &len);
+  ERR_clear_error();
+  certs = parse_certs(data, len);
+  ok = certs && sk_X509_num(certs) > 0 &&
+    SSL_CTX_use_certificate(ctx, sk_X509_value(certs, 0)) == 1;
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+  if (ok)
+    ok = SSL_CTX_clear_chain_certs(ctx) == 1;
+  while (ok && sk_X509_num(certs) > 1) {
+    cert = sk_X509_delete(certs, 1);
+    ok = SSL_CTX_add0_chain_cert(ctx, cert) == 1;
+    if (!ok)
+      X509_free(cert);
+  }
+#else
+  while (ok && sk_X509_num(certs) > 1) {
+    cert = sk_X509_delete(certs, 1);
+    ok = SSL_CTX_add_extra_chain_cert(ctx, cert) == 1;
+    if (!ok)
+      X509_free(cert);
+  }
+#endif
+  sk_X509_pop_free(certs, X509_free);
+  if (!ok) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading certificate (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Add the trusting certificates of a string, PEM or concatenated DER.
+ */
+static int load_ca_data(lua_State *L)
+{
+  int i;
+  size_t len;
+  int ok;
+  STACK_OF(X509) *certs;
+  X509_STORE *store;
+  p_context ctx = checkctx(L, 1);
+  const char *data = luaL_checklstring(L, 2, &len);
+  /* Do not change a store shared with other contexts */
+  detach_store(L, ctx);
+  store = SSL_CTX_get_cert_store(ctx->context);
+  ERR_clear_error();
+  certs = parse_certs(data, len);
+  ok = certs && sk_X509_num(certs) > 0;
+  for (i = 0; ok && i < sk_X509_num(certs); i++)
+    ok = X509_STORE_add_cert(store, sk_X509_value(certs, i)) == 1;
+  sk_X509_pop_free(certs, X509_free);
+  if (!ok) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading CA certificates (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  if (ctx->vcache)
+    vcache_flush(ctx->vcache);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+/**
+ * Return 1 if the table at 'idx' has the field.
+ */
+static int has_field(lua_State *L, int idx, const char *name)
+{
+  int ret;
+  lua_getfield(L, idx, name);
+  ret = !lua_isnil(L, -1);
+  lua_pop(L, 1);
+  return ret;
+}
+
+/**
+ * Call a loader on the context at 'ctx' with the fields 'name' and
+ * 'extra' of the table at 'cfg'. Raise the error of the loader.
+ */
+static void stage_call(lua_State *L, lua_CFunction f, int ctx, int cfg,
+  const char *name, const char *extra)
+{
+  lua_pushcfunction(L, f);
+  lua_pushvalue(L, ctx);
+  lua_getfield(L, cfg, name);
+  if (extra)
+    lua_getfield(L, cfg, extra);
+  else
+    lua_pushnil(L);
+  lua_call(L, 3, 2);
+  if (!lua_toboolean(L, -2))
+    lua_error(L);
+  lua_pop(L, 2);
+}
+
+/**
+ * Load a key pair of the table at 'cfg': strings, an ssl.key, or files.
+ */
+static void stage_pair(lua_State *L, int ctx, int cfg)
+{
+  if (has_field(L, cfg, "keydata"))
+    stage_call(L, load_key_data, ctx, cfg, "keydata", "password");
+  else if (has_field(L, cfg, "key"))
+    stage_call(L, load_key, ctx, cfg, "key", "password");
+  if (has_field(L, cfg, "certificatedata"))
+    stage_call(L, load_cert_data, ctx, cfg, "certificatedata", NULL);
+  else if (has_field(L, cfg, "certificate"))
+    stage_call(L, load_cert, ctx, cfg, "certificate", NULL);
+}
+
+/**
+ * Load the key pairs and the CAs of the table at 1 into a new context
+ * -- protected call of reload(). The chain is built against the trust
+ * store the context at 2 will use: the new store, the new CAs, or its
+ * current store.
+ */
+static int stage(lua_State *L)
+{
+  int i, n;
+  lua_settop(L, 2);
+  lua_pushcfunction(L, create);
+  lua_pushstring(L, "sslv23");
+  lua_call(L, 1, 2);
+  if (lua_isnil(L, -2))
+    lua_error(L);
+  lua_pop(L, 1);
+  /* The staged context is at 3. It checks the pairs like the live one. */
+  SSL_CTX_set_security_level(ctx_getcontext(L, 3),
+    SSL_CTX_get_security_level(ctx_getcontext(L, 2)));
+  stage_pair(L, 3, 1);
+  lua_getfield(L, 1, "certificates");
+  if (lua_istable(L, 4)) {
+    n = (int)lua_objlen(L, 4);
+    for (i = 1; i <= n; i++) {
+      lua_rawgeti(L, 4, i);
+      luaL_checktype(L, 5, LUA_TTABLE);
+      stage_pair(L, 3, 5);
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, 1, "store");
+  if (!lua_isnil(L, 4)) {
+    SSL_CTX_set1_cert_store(ctx_getcontext(L, 3),
+      store_getstore(L, 4)->store);
+  } else if (has_field(L, 1, "cafile") || has_field(L, 1, "capath") ||
+             has_field(L, 1, "cadata")) {
+    if (has_field(L, 1, "cafile") || has_field(L, 1, "capath"))
+      stage_call(L, load_locations, 3, 1, "cafile", "capath");
+    if (has_field(L, 1, "cadata"))
+      stage_call(L, load_ca_data, 3, 1, "cadata", NULL);
+  } else {
+    SSL_CTX_set1_cert_store(ctx_getcontext(L, 3),
+      SSL_CTX_get_cert_store(ctx_getcontext(L, 2)));
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, 1, "chain");
+  if (lua_toboolean(L, 4)) {
+    lua_pushcfunction(L, build_chain);
+    lua_pushvalue(L, 3);
+    n = 1;
+    if (lua_istable(L, 4)) {
+      for (i = 1; i <= (int)lua_objlen(L, 4); i++, n++)
+        lua_rawgeti(L, 4, i);
+    }
+    lua_call(L, n, 2);
+    if (!lua_toboolean(L, -2))
+      lua_error(L);
+  }
+  lua_settop(L, 3);
+  return 1;
+}
+
+/**
+ * Return the key type of the current certificate, or NID_undef.
+ */
+static int current_keytype(SSL_CTX *ctx)
+{
+  X509 *cert = SSL_CTX_get0_certificate(ctx);
+  EVP_PKEY *pkey = cert ? X509_get0_pubkey(cert) : NULL;
+  return pkey ? EVP_PKEY_base_id(pkey) : NID_undef;
+}
+
+/**
+ * Make the certificate with the key type the current one. Return 0 if
+ * the context has none.
+ */
+static int select_keytype(SSL_CTX *ctx, int type)
+{
+  int i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+  for ( ; i; i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+    if (type != NID_undef && current_keytype(ctx) == type)
+      return 1;
+  }
+  return 0;
+}
+
+/* Key pairs of a context, kept to undo a reload */
+#define RELOAD_MAXPAIRS 16
+
+typedef struct t_pair_ {
+  X509 *cert;
+  EVP_PKEY *key;
+  STACK_OF(X509) *chain;
+} t_pair;
+
+/**
+ * Release the saved key pairs.
+ */
+static void free_pairs(t_pair *pairs, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    X509_free(pairs[i].cert);
+    EVP_PKEY_free(pairs[i].key);
+    sk_X509_pop_free(pairs[i].chain, X509_free);
+  }
+}
+
+/**
+ * Take a reference to every key pair of the context. Return their
+ * number, or -1.
+ */
+static int save_pairs(SSL_CTX *ctx, t_pair *pairs)
+{
+  int n = 0;
+  STACK_OF(X509) *chain;
+  int i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+  for ( ; i; i = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+    if (n == RELOAD_MAXPAIRS)
+      goto error;
+    chain = NULL;
+    SSL_CTX_get0_chain_certs(ctx, &chain);
+    pairs[n].chain = NULL;
+    if (chain && !(pairs[n].chain = X509_chain_up_ref(chain)))
+      goto error;
+    pairs[n].cert = SSL_CTX_get0_certificate(ctx);
+    pairs[n].key = SSL_CTX_get0_privatekey(ctx);
+    X509_up_ref(pairs[n].cert);
+    EVP_PKEY_up_ref(pairs[n].key);
+    n++;
+  }
+  return n;
+error:
+  free_pairs(pairs, n);
+  return -1;
+}
+
+/**
+ * Put the saved key pairs back in the context.
+ */
+static void restore_pairs(SSL_CTX *ctx, t_pair *pairs, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    SSL_CTX_use_cert_and_key(ctx, pairs[i].cert, pairs[i].key,
+      pairs[i].chain, 1);
+  }
+}
+
+/**
+ * Record a failed reload: return false and the message at the top.
+ */
+static int reload_failed(lua_State *L, p_context ctx)
+{
+  ctx->reloadfailures++;
+  lua_pushboolean(L, 0);
+  lua_insert(L, -2);
+  return 2;
+}
+#endif
+
+/**
+ * Load new key pairs and CAs aside (the fields of newcontext: key,
+ * certificate, keydata, certificates, cafile, cadata, store, chain...)
+ * and swap them in for the next handshakes. The connections keep the
+ * material they were created with, the session cache is kept, and on
+ * error nothing changes.
+ */
+static int reload(lua_State *L)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  int i;
+  int current;
+  int nsaved;
+  double elapsed;
+  X509 *cert;
+  EVP_PKEY *pkey;
+  STACK_OF(X509) *chain;
+  p_store st = NULL;
+  p_context staged;
+  t_pair saved[RELOAD_MAXPAIRS];
+  p_context ctx = checkctx(L, 1);
+  double start = timeout_gettime();
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_settop(L, 2);
+  lua_pushcfunction(L, stage);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 1);
+  if (lua_pcall(L, 2, 1, 0) != 0)
+    return reload_failed(L, ctx);
+  staged = checkctx(L, 3);
+  /* Check every pair before changing the context */
+  i = SSL_CTX_set_current_cert(staged->context, SSL_CERT_SET_FIRST);
+  for ( ; i; i = SSL_CTX_set_current_cert(staged->context, SSL_CERT_SET_NEXT)) {
+    if (SSL_CTX_check_private_key(staged->context) != 1) {
+      lua_pushfstring(L, "error loading private key (%s)",
+        ERR_reason_error_string(ERR_get_error()));
+      return reload_failed(L, ctx);
+    }
+  }
+  /* A certificate cannot be removed, every key type in use is replaced */
+  current = current_keytype(ctx->context);
+  i = SSL_CTX_set_current_cert(ctx->context, SSL_CERT_SET_FIRST);
+  for ( ; i && SSL_CTX_get0_certificate(staged->context);
+       i = SSL_CTX_set_current_cert(ctx->context, SSL_CERT_SET_NEXT)) {
+    if (!select_keytype(staged->context, current_keytype(ctx->context))) {
+      select_keytype(ctx->context, current);
+      lua_pushstring(L, "no new certificate for a key type in use");
+      return reload_failed(L, ctx);
+    }
+  }
+  /* Every step that may fail is done before the context changes */
+  if (has_field(L, 2, "store")) {
+    lua_getfield(L, 2, "store");
+    st = store_getstore(L, -1);
+    lua_pop(L, 1);
+    if (!store_reserve(st)) {
+      select_keytype(ctx->context, current);
+      lua_pushstring(L, "error attaching trust store");
+      return reload_failed(L, ctx);
+    }
+  }
+  nsaved = save_pairs(ctx->context, saved);
+  if (nsaved < 0) {
+    select_keytype(ctx->context, current);
+    lua_pushstring(L, "error saving the current certificates");
+    return reload_failed(L, ctx);
+  }
+  i = SSL_CTX_set_current_cert(staged->context, SSL_CERT_SET_FIRST);
+  for ( ; i; i = SSL_CTX_set_current_cert(staged->context, SSL_CERT_SET_NEXT)) {
+    cert = SSL_CTX_get0_certificate(staged->context);
+    pkey = SSL_CTX_get0_privatekey(staged->context);
+    SSL_CTX_get0_chain_certs(staged->context, &chain);
+    if (SSL_CTX_use_cert_and_key(ctx->context, cert, pkey, chain, 1) != 1) {
+      /* Only out of memory, the staged context loaded the same pairs */
+      lua_pushfstring(L, "error loading certificate (%s)",
+        ERR_reason_error_string(ERR_get_error()));
+      restore_pairs(ctx->context, saved, nsaved);
+      free_pairs(saved, nsaved);
+      select_keytype(ctx->context, current);
+      return reload_failed(L, ctx);
+    }
+  }
+  free_pairs(saved, nsaved);
+  /* The loops above moved the current certificate */
+  select_keytype(ctx->context, current);
+  if (st) {
+    /* Cannot fail: room was reserved */
+    detach_store(L, ctx);
+    store_attach(st, ctx->context);
+    ctx->store = st;
+    lua_getfield(L, 2, "store");
+    ctx_setref(L, ctx, "store", lua_gettop(L));
+    lua_pop(L, 1);
+    if (ctx->vcache)
+      vcache_flush(ctx->vcache);
+  } else if (has_field(L, 2, "cafile") || has_field(L, 2, "capath") ||
+             has_field(L, 2, "cadata")) {
+    detach_store(L, ctx);
+    SSL_CTX_set1_cert_store(ctx->context,
+      SSL_CTX_get_cert_store(staged->context));
+  }
+#if defined(TLSEXT_comp_cert_zlib)
+  /* Compress the new certificates again, with the same algorithms. The
+     old compressed chains went away with the old pairs: an algorithm
+     that fails now is not reported, the chain is sent uncompressed. */
+  ctx->certsize = 0;
+  memset(ctx->certcomp, 0, sizeof(ctx->certcomp));
+  for (i = TLSEXT_comp_cert_zlib; i <= TLSEXT_comp_cert_zstd; i++) {
+    unsigned char *data = NULL;
+    size_t orig;
+    if (!(ctx->certalgs & (1 << i)))
+      continue;
+    if (SSL_CTX_compress_certs(ctx->context, i) == 1) {
+      ctx->certcomp[i] = SSL_CTX_get1_compressed_cert(ctx->context, i, &data,
+        &orig);
+      ctx->certsize = orig;
+    } else
+      ERR_clear_error();
+    OPENSSL_free(data);
+  }
+#endif
+  elapsed = timeout_gettime() - start;
+  ctx->reloads++;
+  ctx->reloadtime = elapsed;
+  if (elapsed > ctx->reloadmax)
+    ctx->reloadmax = elapsed;
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "reload not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Map server names to contexts. The table keys are host names, possibly
+ * with a leading "*." wildcard label, and the values are contexts.
+ * If 'strict' is set, handshakes with an unknown name are rejected.
+ */
+static int set_sni(lua_State *L)
+{
+  p_sni sni;
+  p_context ctx = checkctx(L, 1);
+  int strict = lua_toboolean(L, 3);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  sni = (p_sni)malloc(sizeof(t_sni));
+  if (!sni || !sni_init(sni)) {
+    free(sni);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating server name table");
+    return 2;
+  }
+  sni->strict = strict;
+  lua_newtable(L);   /* contexts referenced by the dispatcher */
+  lua_pushnil(L);
+  while (lua_next(L, 2)) {
+    p_context target = testctx(L, -1);
+    if (!target || lua_type(L, -2) != LUA_TSTRING ||
+        !sni_add(sni, lua_tostring(L, -2), target)) {
+      sni_free(sni);
+      free(sni);
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "invalid server name");
+      return 2;
+    }
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, -4);
+  }
+  free_sni(ctx);
+  ctx->sni = sni;
+  ctx_setref(L, ctx, "sni", -1);
+  SSL_CTX_set_tlsext_servername_callback(ctx->context, servername_cb);
+  SSL_CTX_set_tlsext_servername_arg(ctx->context, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Load certificates on demand by server name. The source is a directory
+ * with "<name>.pem" and "<name>.key" files, or a function that receives
+ * the name and returns a context (or nil). At most 'maxentries' contexts
+ * and about 'maxbytes' bytes are cached (0 means no limit). With 'async'
+ * a miss suspends the handshake ("Waiting for callback") until the
+ * context is supplied by provide().
+ */
+static int set_provider(lua_State *L)
+{
+#if defined(PROVIDER_ENABLED)
+  p_provider p;
+  p_context ctx = checkctx(L, 1);
+  const char *dir = NULL;
+  size_t maxentries = (size_t)luaL_optnumber(L, 3, 0);
+  size_t maxbytes = (size_t)luaL_optnumber(L, 4, 0);
+  int async = lua_toboolean(L, 5);
+  if (lua_type(L, 2) == LUA_TSTRING)
+    dir = lua_tostring(L, 2);
+  else if (!lua_isfunction(L, 2))
+    luaL_typerror(L, 2, "string or function");
+  p = (p_provider)malloc(sizeof(t_provider));
+  if (!p || !provider_init(p, dir, maxentries, maxbytes, async)) {
+    free(p);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating certificate provider");
+    return 2;
+  }
+  free_provider(ctx);
+  ctx->provider = p;
+  ctx_setref(L, ctx, "provider", 2);
+  SSL_CTX_set_cert_cb(ctx->context, cert_cb, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "certificate provider not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Supply the context for a server name to the certificate provider,
+ * or nil if the name is unknown.
+ */
+static int provide(lua_State *L)
+{
+#if defined(PROVIDER_ENABLED)
+  p_context sub = NULL;
+  p_context ctx = checkctx(L, 1);
+  const char *name = luaL_checkstring(L, 2);
+  if (!lua_isnoneornil(L, 3))
+    sub = checkctx(L, 3);
+  if (!ctx->provider) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "no certificate provider");
+    return 2;
+  }
+  if (!provider_put(ctx->provider, name, sub ? sub->context : NULL)) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error caching certificate");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "certificate provider not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Set the cipher list.
+ */
+static int set_cipher(lua_State *L)
+{
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *list = luaL_checkstring(L, 2);
+  if (SSL_CTX_set_cipher_list(ctx, list) != 1) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error setting cipher list (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+#if defined(TLSEXT_comp_cert_zlib)
+static const char *comp_names[] = { NULL, "zlib", "brotli", "zstd" };
+
+/**
+ * Map a certificate compression algorithm name to its RFC 8879 code.
+ */
+static int comp_alg(const char *name)
+{
+  int i;
+  for (i = TLSEXT_comp_cert_zlib; i <= TLSEXT_comp_cert_zstd; i++) {
+    if (!strcmp(name, comp_names[i]))
+      return i;
+  }
+  return TLSEXT_comp_cert_none;
+}
+#endif
+
+/**
+ * Enable certificate compression (RFC 8879) with the given algorithms,
+ * in order of preference: "zlib", "brotli", "zstd". Clients advertise
+ * them. Servers compress the certificate chain once, here, so it must be
+ * loaded before; algorithms missing from the OpenSSL build are skipped.
+ */
+static int set_cert_compression(lua_State *L)
+{
+#if defined(TLSEXT_comp_cert_zlib)
+  int i, done;
+  size_t len, orig;
+  unsigned char *data;
+  int algs[TLSEXT_comp_cert_zstd];
+  p_context ctx = checkctx(L, 1);
+  int n = lua_gettop(L) - 1;
+  if (n < 1 || n > TLSEXT_comp_cert_zstd) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "invalid number of compression algorithms");
+    return 2;
+  }
+  for (i = 0; i < n; i++) {
+    const char *name = luaL_checkstring(L, i + 2);
+    algs[i] = comp_alg(name);
+    if (algs[i] == TLSEXT_comp_cert_none) {
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "invalid compression algorithm (%s)", name);
+      return 2;
+    }
+  }
+  if (SSL_CTX_set1_cert_comp_preference(ctx->context, algs, (size_t)n) != 1) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error setting certificate compression (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  if (ctx->mode != MD_CTX_SERVER) {
+    lua_pushboolean(L, 1);
+    return 1;
+  }
+  done = 0;
+  ctx->certsize = 0;
+  memset(ctx->certcomp, 0, sizeof(ctx->certcomp));
+  ctx->certalgs = 0;
+  for (i = 0; i < n; i++) {
+    ctx->certalgs |= 1 << algs[i];
+    if (SSL_CTX_compress_certs(ctx->context, algs[i]) != 1) {
+      ERR_clear_error();
+      continue;
+    }
+    data = NULL;
+    len = SSL_CTX_get1_compressed_cert(ctx->context, algs[i], &data, &orig);
+    if (len > 0) {
+      ctx->certcomp[algs[i]] = len;
+      ctx->certsize = orig;
+      done++;
+    }
+    OPENSSL_free(data);
+  }
+  if (!done) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error compressing certificates");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "certificate compression not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Set the key exchange groups (curves), in order of preference,
+ * e.g. "X25519:P-256". Before OpenSSL 1.0.2 only the first one is used.
  */
-static p_context checkctx(lua_State *L, int idx)
+static int set_groups(lua_State *L)
 {
-  return (p_context)luaL_checkudata(L, idx, "SSL:Context");
+  p_context c = checkctx(L, 1);
+  SSL_CTX *ctx = c->context;
+  const char *list = luaL_checkstring(L, 2);
+#if defined(SSL_CTX_set1_groups_list)
+  if (SSL_CTX_set1_groups_list(ctx, list) != 1) {
+#elif defined(SSL_CTX_set1_curves_list)
+  SSL_CTX_set_ecdh_auto(ctx, 1);
+  if (SSL_CTX_set1_curves_list(ctx, list) != 1) {
+#else
+  int nid;
+  EC_KEY *key;
+  char name[64];
+  size_t len = strcspn(list, ":,");
+  if (len >= sizeof(name))
+    len = sizeof(name) - 1;
+  memcpy(name, list, len);
+  name[len] = '\0';
+  nid = OBJ_sn2nid(name);
+  key = (nid != NID_undef) ? EC_KEY_new_by_curve_name(nid) : NULL;
+  SSL_CTX_set_options(ctx, SSL_OP_SINGLE_ECDH_USE);
+  if (!key || SSL_CTX_set_tmp_ecdh(ctx, key) != 1) {
+    EC_KEY_free(key);
+#endif
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error setting groups (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+#if !defined(SSL_CTX_set1_groups_list) && !defined(SSL_CTX_set1_curves_list)
+  EC_KEY_free(key);
+#endif
+  free(c->groups);
+  c->groups = strdup(list);
+#if defined(KEYSHARE_ENABLED)
+  if (c->keyshare)
+    keyshare_setgroups(c->keyshare, c->groups);
+#endif
+  lua_pushboolean(L, 1);
+  return 1;
 }
 
 /**
- * Prepare the SSL options flag.
+ * Remember the group selected by each destination (at most 'maxdests')
+ * and offer its key share first on the next connection, saving the
+ * round trip of a HelloRetryRequest. Client contexts only.
  */
-static int set_option_flag(const char *opt, unsigned long *flag)
+static int set_keyshare(lua_State *L)
 {
-  ssl_option_t *p;
-  for (p = ssl_options; p->name; p++) {
-    if (!strcmp(opt, p->name)) {
-      *flag |= p->code;
-      return 1;
+#if defined(KEYSHARE_ENABLED)
+  p_context ctx = checkctx(L, 1);
+  int maxdests = luaL_optint(L, 2, 1024);
+  if (!ctx->keyshare) {
+    ctx->keyshare = (p_keyshare)malloc(sizeof(t_keyshare));
+    if (!ctx->keyshare ||
+        !keyshare_init(ctx->keyshare, (size_t)maxdests, ctx->groups)) {
+      free(ctx->keyshare);
+      ctx->keyshare = NULL;
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "error creating key share memory");
+      return 2;
     }
   }
-  return 0;
+  ctx->keyshare->maxdests = (size_t)maxdests;
+  SSL_CTX_set_info_callback(ctx->context, info_cb);
+  SSL_CTX_set_msg_callback(ctx->context, msg_cb);
+  SSL_CTX_set_msg_callback_arg(ctx->context, ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "key share prediction not supported");
+  return 2;
+#endif
 }
 
 /**
- * Find the protocol.
+ * Server: inspect the ClientHello before any expensive work. The function
+ * (or nil) is called as described in hello_cb(); 'requiresni' rejects
+ * clients without a server name and 'minversion' (e.g. "tlsv1_2") the
+ * ones that do not offer it, without calling Lua.
  */
-const static SSL_METHOD* str2method(const char *method)
+static int set_client_hello(lua_State *L)
 {
-  if (!strcmp(method, "sslv3"))  return SSLv3_method();
-  if (!strcmp(method, "tlsv1"))  return TLSv1_method();
-  if (!strcmp(method, "sslv23")) return SSLv23_method();
-  return NULL;
+#if defined(HELLO_ENABLED)
+  int version = 0;
+  p_context ctx = checkctx(L, 1);
+  int requiresni = lua_toboolean(L, 3);
+  const char *min = luaL_optstring(L, 4, NULL);
+  if (!lua_isnoneornil(L, 2))
+    luaL_checktype(L, 2, LUA_TFUNCTION);
+  if (min && !(version = hello_version(min))) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "invalid protocol (%s)", min);
+    return 2;
+  }
+  if (!ctx->hello) {
+    ctx->hello = (p_hello)calloc(1, sizeof(t_hello));
+    if (!ctx->hello) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "error creating ClientHello checks");
+      return 2;
+    }
+  }
+  ctx->hello->requiresni = requiresni;
+  ctx->hello->minversion = version;
+  lua_settop(L, 2);
+  ctx_setref(L, ctx, "clienthello", 2);
+  SSL_CTX_set_client_hello_cb(ctx->context, hello_cb, ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "ClientHello callback not supported");
+  return 2;
+#endif
 }
 
 /**
- * Prepare the SSL handshake verify flag.
+ * Server: run at most 'maxfull' full handshakes at the same time and
+ * defer up to 'maxwaiting' more (dohandshake() fails with "deferred"
+ * until a place is free); refuse the others with an alert right after
+ * the ClientHello. Clients offering to resume a session are admitted,
+ * and wait or are refused like the others if it is not resumed. A
+ * 'maxfull' of 0 removes the limit.
  */
-static int set_verify_flag(const char *str, int *flag)
+static int set_governor(lua_State *L)
 {
-  if (!strcmp(str, "none")) { 
-    *flag |= SSL_VERIFY_NONE;
-    return 1;
+#if defined(GOVERNOR_ENABLED)
+  p_context ctx = checkctx(L, 1);
+  lua_Number maxfull = luaL_checknumber(L, 2);
+  lua_Number maxwaiting = luaL_optnumber(L, 3, 0);
+  if (ctx->mode != MD_CTX_SERVER) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "handshake governor needs a server context");
+    return 2;
   }
-  if (!strcmp(str, "peer")) {
-    *flag |= SSL_VERIFY_PEER;
+  if (maxfull <= 0) {
+    free(ctx->governor);
+    ctx->governor = NULL;
+    lua_pushboolean(L, 1);
     return 1;
   }
-  if (!strcmp(str, "client_once")) {
-    *flag |= SSL_VERIFY_CLIENT_ONCE;
-    return 1;
+  /* Keep the counters of the handshakes in progress */
+  if (!ctx->governor) {
+    ctx->governor = (p_governor)calloc(1, sizeof(t_governor));
+    if (!ctx->governor) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "error creating handshake governor");
+      return 2;
+    }
   }
-  if (!strcmp(str, "fail_if_no_peer_cert")) { 
-    *flag |= SSL_VERIFY_FAIL_IF_NO_PEER_CERT;
+  ctx->governor->maxfull = (size_t)maxfull;
+  ctx->governor->maxwaiting = maxwaiting > 0 ? (size_t)maxwaiting : 0;
+  SSL_CTX_set_client_hello_cb(ctx->context, hello_cb, ctx);
+  SSL_CTX_set_cert_cb(ctx->context, cert_cb, (void*)ctx);
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "handshake governor not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Record when each handshake reaches its ClientHello, ServerHello,
+ * Certificate, key exchange and Finished messages, per connection (see
+ * conn:timing()) and in histograms of the context, split into full and
+ * resumed handshakes. Applies to the connections created afterwards.
+ */
+static int set_timing(lua_State *L)
+{
+  p_context ctx = checkctx(L, 1);
+  if (!lua_toboolean(L, 2)) {
+    free(ctx->timing);
+    ctx->timing = NULL;
+    lua_pushboolean(L, 1);
     return 1;
   }
-  return 0;
+  if (!ctx->timing) {
+    ctx->timing = (p_timing)calloc(1, sizeof(t_timing));
+    if (!ctx->timing) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "error creating handshake timing");
+      return 2;
+    }
+  }
+  SSL_CTX_set_info_callback(ctx->context, info_cb);
+  SSL_CTX_set_msg_callback(ctx->context, msg_cb);
+  SSL_CTX_set_msg_callback_arg(ctx->context, ctx);
+  lua_pushboolean(L, 1);
+  return 1;
 }
 
 /**
- * Password callback for reading the private key.
+ * Return the histograms of the handshake phases, in seconds from the
+ * start: {full = {clienthello = {count, mean, min, max, p50, p90, p99,
+ * p999}, serverhello = ..., done = ...}, resumed = {...}}; or nil.
  */
-static int passwd_cb(char *buf, int size, int flag, void *udata)
+static int get_timing(lua_State *L)
 {
-  lua_State *L = (lua_State*)udata;
-  switch (lua_type(L, 3)) {
-  case LUA_TFUNCTION:
-    lua_pushvalue(L, 3);
-    lua_call(L, 0, 1);
-    if (lua_type(L, -1) != LUA_TSTRING)
-       return 0;
-    /* fallback */
-  case LUA_TSTRING:
-    strncpy(buf, lua_tostring(L, -1), size);
-    buf[size-1] = '\0';
-    return (int)strlen(buf);
+  p_context ctx = checkctx(L, 1);
+  if (!ctx->timing) {
+    lua_pushnil(L);
+    return 1;
   }
-  return 0;
+  timing_push(L, ctx->timing);
+  return 1;
 }
 
-/*------------------------------ Lua Functions -------------------------------*/
-
 /**
- * Create a SSL context.
+ * Record the latency of the completed send(), receive() and handshakes
+ * of the connections created afterwards; the context adds them up as
+ * the connections close. Disabling forgets the totals.
  */
-static int create(lua_State *L)
+static int set_latency(lua_State *L)
 {
-  p_context ctx;
-  const SSL_METHOD *method;
+  p_context ctx = checkctx(L, 1);
+  if (!lua_toboolean(L, 2)) {
+    free(ctx->latency);
+    ctx->latency = NULL;
+  } else if (!ctx->latency) {
+    ctx->latency = (p_latency)calloc(1, sizeof(t_latency));
+    if (!ctx->latency) {
+      lua_pushboolean(L, 0);
+      lua_pushstring(L, "error creating latency histograms");
+      return 2;
+    }
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
 
-  method = str2method(luaL_checkstring(L, 1));
-  if (!method) {
+/**
+ * Return the latencies of the closed connections, {send = hist,
+ * receive = hist, handshake = hist} with percentiles in seconds, or nil.
+ */
+static int get_latency(lua_State *L)
+{
+  p_context ctx = checkctx(L, 1);
+  if (!ctx->latency)
     lua_pushnil(L);
-    lua_pushstring(L, "invalid protocol");
-    return 2;
+  else
+    latency_push(L, ctx->latency);
+  return 1;
+}
+
+/**
+ * Export the connections created afterwards by ssl.metrics, under the
+ * label context="name". Contexts with the same name add up their
+ * series. A nil name stops the export; the series remain.
+ */
+static int set_metrics(lua_State *L)
+{
+  size_t len;
+  p_mgroup g;
+  p_context ctx = checkctx(L, 1);
+  const char *name = luaL_optlstring(L, 2, NULL, &len);
+  if (!name) {
+    ctx->metrics = NULL;
+    lua_pushboolean(L, 1);
+    return 1;
   }
-  ctx = (p_context) lua_newuserdata(L, sizeof(t_context));
-  if (!ctx) {
-    lua_pushnil(L);
-    lua_pushstring(L, "error creating context");
+  if (len == 0 || len > METRICS_MAXNAME || strlen(name) != len) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "invalid metrics name");
     return 2;
-  }  
-  ctx->context = SSL_CTX_new(method);
-  if (!ctx->context) {
-    lua_pushnil(L);
-    lua_pushstring(L, "error creating context");
+  }
+  g = metrics_group(name);
+  if (!g) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating metrics");
     return 2;
   }
-  ctx->mode = MD_CTX_INVALID;
-  luaL_getmetatable(L, "SSL:Context");
-  lua_setmetatable(L, -2);
+  ctx->metrics = g;
+  lua_pushboolean(L, 1);
   return 1;
 }
 
 /**
- * Load the trusting certificates.
+ * Server: number of TLS 1.3 session tickets sent after each handshake.
+ * Each ticket resumes one connection, so clients that reconnect in
+ * parallel need several.
  */
-static int load_locations(lua_State *L)
+static int set_num_tickets(lua_State *L)
 {
+#if defined(TICKETS_ENABLED)
   SSL_CTX *ctx = ctx_getcontext(L, 1);
-  const char *cafile = luaL_optstring(L, 2, NULL);
-  const char *capath = luaL_optstring(L, 3, NULL);
-  if (SSL_CTX_load_verify_locations(ctx, cafile, capath) != 1) {
+  int n = luaL_checkint(L, 2);
+  if (n < 0 || SSL_CTX_set_num_tickets(ctx, (size_t)n) != 1) {
     lua_pushboolean(L, 0);
-    lua_pushfstring(L, "error loading CA locations (%s)",
-      ERR_reason_error_string(ERR_get_error()));
+    lua_pushstring(L, "invalid number of tickets");
     return 2;
   }
   lua_pushboolean(L, 1);
   return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "number of tickets not supported");
+  return 2;
+#endif
 }
 
 /**
- * Load the certificate file.
+ * Client: keep up to 'perdest' sessions for each of at most 'maxdests'
+ * destinations (server name, or peer address), and resume every new
+ * connection with a session not used before.
  */
-static int load_cert(lua_State *L)
+static int set_session_store(lua_State *L)
 {
-  SSL_CTX *ctx = ctx_getcontext(L, 1);
-  const char *filename = luaL_checkstring(L, 2);
-  if (SSL_CTX_use_certificate_chain_file(ctx, filename) != 1) {
+#if defined(TICKETS_ENABLED)
+  p_context ctx = checkctx(L, 1);
+  int maxdests = luaL_optint(L, 2, 1024);
+  int perdest = luaL_optint(L, 3, 4);
+  if (maxdests < 0 || perdest < 1) {
     lua_pushboolean(L, 0);
-    lua_pushfstring(L, "error loading certificate (%s)",
-      ERR_reason_error_string(ERR_get_error()));
+    lua_pushstring(L, "invalid session store size");
     return 2;
   }
+  free_tickets(ctx);
+  ctx->tickets = (p_tickets)malloc(sizeof(t_tickets));
+  if (!ctx->tickets ||
+      !tickets_init(ctx->tickets, (size_t)maxdests, (size_t)perdest)) {
+    free(ctx->tickets);
+    ctx->tickets = NULL;
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating session store");
+    return 2;
+  }
+  SSL_CTX_set_session_cache_mode(ctx->context,
+    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ctx->context, new_session_cb);
+  SSL_CTX_set_info_callback(ctx->context, info_cb);
   lua_pushboolean(L, 1);
   return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "session store not supported");
+  return 2;
+#endif
 }
 
 /**
- * Load the key file -- only in PEM format.
+ * Set the pre-shared keys, for TLS 1.2 PSK cipher suites and TLS 1.3
+ * external PSKs.
+ * Client: a table {identity = ..., key = ...}, or a function(hint) that
+ * returns the identity and the key.
+ * Server: a table identity -> key, or a function(identity) that returns
+ * the key; the optional 'hint' is sent to TLS 1.2 clients.
+ * Keys are binary strings.
  */
-static int load_key(lua_State *L)
+static int set_psk(lua_State *L)
 {
-  int ret = 1;
-  SSL_CTX *ctx = ctx_getcontext(L, 1);
-  const char *filename = luaL_checkstring(L, 2);
-  switch (lua_type(L, 3)) {
-  case LUA_TSTRING:
-  case LUA_TFUNCTION:
-    SSL_CTX_set_default_passwd_cb(ctx, passwd_cb);
-    SSL_CTX_set_default_passwd_cb_userdata(ctx, L);
-    /* fallback */
-  case LUA_TNIL: 
-    if (SSL_CTX_use_PrivateKey_file(ctx, filename, SSL_FILETYPE_PEM) == 1)
-      lua_pushboolean(L, 1);
-    else {
-      ret = 2;
+#if defined(PSK_ENABLED)
+  size_t idlen, keylen;
+  const char *id, *key;
+  p_context ctx = checkctx(L, 1);
+  const char *hint = luaL_optstring(L, 3, NULL);
+  luaL_argcheck(L, lua_istable(L, 2) || lua_isfunction(L, 2), 2,
+    "table or function expected");
+  if (ctx->mode == MD_CTX_INVALID) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "invalid mode");
+    return 2;
+  }
+  free_psk(ctx);
+  ctx->psk = (p_psk)malloc(sizeof(t_psk));
+  if (!ctx->psk || !psk_init(ctx->psk)) {
+    free(ctx->psk);
+    ctx->psk = NULL;
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating pre-shared keys");
+    return 2;
+  }
+  if (lua_istable(L, 2) && ctx->mode == MD_CTX_CLIENT) {
+    lua_getfield(L, 2, "identity");
+    lua_getfield(L, 2, "key");
+    id = lua_tolstring(L, -2, &idlen);
+    key = lua_tolstring(L, -1, &keylen);
+    if (!id || !key || !psk_set(ctx->psk, id, idlen, key, keylen)) {
+      free_psk(ctx);
       lua_pushboolean(L, 0);
-      lua_pushfstring(L, "error loading private key (%s)",
+      lua_pushstring(L, "invalid pre-shared key");
+      return 2;
+    }
+    lua_pop(L, 2);
+  } else if (lua_istable(L, 2)) {
+    lua_pushnil(L);
+    while (lua_next(L, 2)) {
+      if (lua_type(L, -2) != LUA_TSTRING || lua_type(L, -1) != LUA_TSTRING) {
+        free_psk(ctx);
+        lua_pushboolean(L, 0);
+        lua_pushstring(L, "invalid pre-shared key");
+        return 2;
+      }
+      id = lua_tolstring(L, -2, &idlen);
+      key = lua_tolstring(L, -1, &keylen);
+      if (!psk_add(ctx->psk, id, idlen, key, keylen)) {
+        free_psk(ctx);
+        lua_pushboolean(L, 0);
+        lua_pushfstring(L, "invalid pre-shared key for '%s'", id);
+        return 2;
+      }
+      lua_pop(L, 1);
+    }
+  }
+  /* The function, if any, is called from the handshake */
+  if (lua_isfunction(L, 2))
+    ctx_setref(L, ctx, "psk", 2);
+  else {
+    lua_pushnil(L);
+    ctx_setref(L, ctx, "psk", -1);
+    lua_pop(L, 1);
+  }
+  if (ctx->mode == MD_CTX_CLIENT) {
+    SSL_CTX_set_psk_client_callback(ctx->context, psk_client_cb);
+#if defined(PSK_TLS13)
+    SSL_CTX_set_psk_use_session_callback(ctx->context, psk_use_session_cb);
+#endif
+  } else {
+    if (hint && SSL_CTX_use_psk_identity_hint(ctx->context, hint) != 1) {
+      lua_pushboolean(L, 0);
+      lua_pushfstring(L, "error setting PSK identity hint (%s)",
         ERR_reason_error_string(ERR_get_error()));
+      return 2;
     }
-    SSL_CTX_set_default_passwd_cb(ctx, NULL);
-    SSL_CTX_set_default_passwd_cb_userdata(ctx, NULL);
-    break;
-  default:
-    lua_pushstring(L, "invalid callback value");
-    lua_error(L);
+    SSL_CTX_set_psk_server_callback(ctx->context, psk_server_cb);
+#if defined(PSK_TLS13)
+    SSL_CTX_set_psk_find_session_callback(ctx->context, psk_find_session_cb);
+#endif
   }
-  return ret;
+  lua_pushboolean(L, 1);
+  return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "pre-shared keys not supported");
+  return 2;
+#endif
 }
 
 /**
- * Set the cipher list.
+ * Set the signature algorithms, in order of preference,
+ * e.g. "ed25519:ECDSA+SHA256:RSA-PSS+SHA256".
  */
-static int set_cipher(lua_State *L)
+static int set_sigalgs(lua_State *L)
 {
+#if defined(SSL_CTX_set1_sigalgs_list)
   SSL_CTX *ctx = ctx_getcontext(L, 1);
   const char *list = luaL_checkstring(L, 2);
-  if (SSL_CTX_set_cipher_list(ctx, list) != 1) {
+  if (SSL_CTX_set1_sigalgs_list(ctx, list) != 1) {
     lua_pushboolean(L, 0);
-    lua_pushfstring(L, "error setting cipher list (%s)",
+    lua_pushfstring(L, "error setting signature algorithms (%s)",
       ERR_reason_error_string(ERR_get_error()));
     return 2;
   }
   lua_pushboolean(L, 1);
   return 1;
+#else
+  lua_pushboolean(L, 0);
+  lua_pushstring(L, "signature algorithms not supported");
+  return 2;
+#endif
+}
+
+/**
+ * Order AES-GCM and ChaCha20-Poly1305 for this machine: "aesgcm",
+ * "chacha20", or "auto" (AES-GCM first if the CPU has AES instructions).
+ * The server preference is enabled, but a client that lists ChaCha20
+ * first -- usually a client without AES instructions -- still gets it.
+ */
+static int set_cipher_preference(lua_State *L)
+{
+  int aes;
+  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  const char *mode = luaL_optstring(L, 2, "auto");
+  if (!strcmp(mode, "auto"))
+    aes = has_aes_hw();
+  else if (!strcmp(mode, "aesgcm"))
+    aes = 1;
+  else if (!strcmp(mode, "chacha20"))
+    aes = 0;
+  else {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "invalid cipher preference");
+    return 2;
+  }
+  if (SSL_CTX_set_cipher_list(ctx, aes ?
+        "ECDHE+AESGCM:ECDHE+CHACHA20:DHE+AESGCM:DHE+CHACHA20:HIGH:!aNULL:!MD5" :
+        "ECDHE+CHACHA20:ECDHE+AESGCM:DHE+CHACHA20:DHE+AESGCM:HIGH:!aNULL:!MD5")
+      != 1) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error setting cipher list (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  SSL_CTX_set_ciphersuites(ctx, aes ?
+    "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:TLS_CHACHA20_POLY1305_SHA256" :
+    "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384");
+#endif
+  SSL_CTX_set_options(ctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+#if defined(SSL_OP_PRIORITIZE_CHACHA)
+  SSL_CTX_set_options(ctx, SSL_OP_PRIORITIZE_CHACHA);
+#endif
+  lua_pushboolean(L, 1);
+  lua_pushstring(L, aes ? "aesgcm" : "chacha20");
+  return 2;
 }
 
 /**
@@ -408,7 +2690,8 @@ static int get_cache_size(lua_State *L)
  */
 static int ctx_stats(lua_State *L)
 {
-  SSL_CTX *ctx = ctx_getcontext(L, 1);
+  p_context c = checkctx(L, 1);
+  SSL_CTX *ctx = c->context;
   lua_createtable(L,0,12);
   lua_pushnumber(L, SSL_CTX_sess_number(ctx));
   lua_setfield(L,-2,"number");
@@ -434,6 +2717,127 @@ static int ctx_stats(lua_State *L)
   lua_setfield(L,-2,"timeouts");
   lua_pushnumber(L, SSL_CTX_sess_cache_full(ctx));
   lua_setfield(L,-2,"cache_full");
+  if (c->ioclosed) {
+    lua_pushnumber(L, c->ioclosed);
+    lua_setfield(L,-2,"io_connections");
+    iostats_push(L, &c->io, "io_");
+  }
+  if (c->reloads || c->reloadfailures) {
+    lua_pushnumber(L, c->reloads);
+    lua_setfield(L,-2,"reloads");
+    lua_pushnumber(L, c->reloadfailures);
+    lua_setfield(L,-2,"reload_failures");
+    lua_pushnumber(L, c->reloadtime);
+    lua_setfield(L,-2,"reload_time");
+    lua_pushnumber(L, c->reloadmax);
+    lua_setfield(L,-2,"reload_time_max");
+  }
+  if (c->crl) {
+    lua_pushnumber(L, c->crl->checks);
+    lua_setfield(L,-2,"crl_checks");
+    lua_pushnumber(L, c->crl->revoked);
+    lua_setfield(L,-2,"crl_revoked");
+  }
+  if (c->ocsp) {
+    lua_pushnumber(L, c->ocsp->stapled);
+    lua_setfield(L,-2,"ocsp_stapled");
+    lua_pushnumber(L, c->ocsp->hits);
+    lua_setfield(L,-2,"ocsp_hits");
+    lua_pushnumber(L, c->ocsp->misses);
+    lua_setfield(L,-2,"ocsp_misses");
+    lua_pushnumber(L, c->ocsp->revoked);
+    lua_setfield(L,-2,"ocsp_revoked");
+    lua_pushnumber(L, c->ocsp->invalid);
+    lua_setfield(L,-2,"ocsp_invalid");
+  }
+  if (c->pins) {
+    lua_pushnumber(L, c->pins->hits);
+    lua_setfield(L,-2,"pin_hits");
+    lua_pushnumber(L, c->pins->misses);
+    lua_setfield(L,-2,"pin_misses");
+  }
+  if (c->vcache) {
+    lua_pushnumber(L, c->vcache->hits);
+    lua_setfield(L,-2,"verify_hits");
+    lua_pushnumber(L, c->vcache->misses);
+    lua_setfield(L,-2,"verify_misses");
+  }
+  if (c->keyshare) {
+    lua_pushnumber(L, c->keyshare->predicted);
+    lua_setfield(L,-2,"keyshare_predicted");
+    lua_pushnumber(L, c->keyshare->hrr);
+    lua_setfield(L,-2,"hrr");
+  }
+#if defined(TLSEXT_comp_cert_zlib)
+  if (c->certsize) {
+    int i;
+    lua_pushnumber(L, c->certsize);
+    lua_setfield(L,-2,"cert_size");
+    for (i = TLSEXT_comp_cert_zlib; i <= TLSEXT_comp_cert_zstd; i++) {
+      if (c->certcomp[i]) {
+        lua_pushfstring(L, "cert_size_%s", comp_names[i]);
+        lua_pushnumber(L, c->certcomp[i]);
+        lua_rawset(L,-3);
+      }
+    }
+  }
+#endif
+  if (c->hello) {
+    lua_pushnumber(L, c->hello->accepted);
+    lua_setfield(L,-2,"hello_accepted");
+    lua_pushnumber(L, c->hello->rejected);
+    lua_setfield(L,-2,"hello_rejected");
+    lua_pushnumber(L, c->hello->switched);
+    lua_setfield(L,-2,"hello_switched");
+    lua_pushnumber(L, c->hello->failures);
+    lua_setfield(L,-2,"hello_failures");
+  }
+  if (c->governor) {
+    lua_pushnumber(L, c->governor->admitted);
+    lua_setfield(L,-2,"handshakes_admitted");
+    lua_pushnumber(L, c->governor->resumable);
+    lua_setfield(L,-2,"handshakes_resumable");
+    lua_pushnumber(L, c->governor->notresumed);
+    lua_setfield(L,-2,"handshakes_not_resumed");
+    lua_pushnumber(L, c->governor->deferred);
+    lua_setfield(L,-2,"handshakes_deferred");
+    lua_pushnumber(L, c->governor->shed);
+    lua_setfield(L,-2,"handshakes_shed");
+    lua_pushnumber(L, c->governor->active);
+    lua_setfield(L,-2,"handshakes_active");
+    lua_pushnumber(L, c->governor->waiting);
+    lua_setfield(L,-2,"handshakes_waiting");
+  }
+  if (c->tickets) {
+    lua_pushnumber(L, c->tickets->hits);
+    lua_setfield(L,-2,"store_hits");
+    lua_pushnumber(L, c->tickets->misses);
+    lua_setfield(L,-2,"store_misses");
+    lua_pushnumber(L, c->tickets->count);
+    lua_setfield(L,-2,"store_sessions");
+  }
+  if (c->psk) {
+    lua_pushnumber(L, c->psk->hits);
+    lua_setfield(L,-2,"psk_hits");
+    lua_pushnumber(L, c->psk->misses);
+    lua_setfield(L,-2,"psk_misses");
+  }
+  if (c->provider) {
+    lua_pushnumber(L, c->provider->hits);
+    lua_setfield(L,-2,"cert_hits");
+    lua_pushnumber(L, c->provider->misses);
+    lua_setfield(L,-2,"cert_misses");
+    lua_pushnumber(L, c->provider->evictions);
+    lua_setfield(L,-2,"cert_evictions");
+    lua_pushnumber(L, c->provider->unknownevictions);
+    lua_setfield(L,-2,"cert_unknown_evictions");
+    lua_pushnumber(L, c->provider->failures);
+    lua_setfield(L,-2,"cert_failures");
+    lua_pushnumber(L, c->provider->cache.count);
+    lua_setfield(L,-2,"cert_entries");
+    lua_pushnumber(L, c->provider->bytes);
+    lua_setfield(L,-2,"cert_bytes");
+  }
   return 1;
 }
 
@@ -460,9 +2864,37 @@ static luaL_Reg funcs[] = {
  */
 static luaL_Reg methods[] = {
   {"locations",  load_locations},
+  {"setstore",   set_store},
+  {"setverifycache", set_verify_cache},
+  {"setpins",    set_pins},
+  {"setcrl",     set_crl},
+  {"setocsp",    set_ocsp},
   {"loadcert",   load_cert},
   {"loadkey",    load_key},
+  {"loadcertdata", load_cert_data},
+  {"loadkeydata", load_key_data},
+  {"loadcadata", load_ca_data},
+  {"reload",     reload},
+  {"buildchain", build_chain},
+  {"setsni",     set_sni},
+  {"setprovider", set_provider},
+  {"provide",    provide},
   {"setcipher",  set_cipher},
+  {"setcipherpreference", set_cipher_preference},
+  {"setgroups",  set_groups},
+  {"setsigalgs", set_sigalgs},
+  {"setkeyshare", set_keyshare},
+  {"setcertcompression", set_cert_compression},
+  {"setpsk",     set_psk},
+  {"setnumtickets", set_num_tickets},
+  {"setclienthello", set_client_hello},
+  {"setgovernor", set_governor},
+  {"settiming",  set_timing},
+  {"timing",     get_timing},
+  {"setlatency", set_latency},
+  {"latency",    get_latency},
+  {"setmetrics", set_metrics},
+  {"setsessionstore", set_session_store},
   {"setdepth",   set_depth},
   {"setverify",  set_verify},
   {"setoptions", set_options},
@@ -485,10 +2917,32 @@ static luaL_Reg methods[] = {
 static int meth_destroy(lua_State *L)
 {
   p_context ctx = checkctx(L, 1);
+  if (ctx->store) {
+    store_detach(ctx->store, ctx->context);
+    ctx->store = NULL;
+  }
   if (ctx->context) {
+    /* Connections may outlive the context */
+    SSL_CTX_set_app_data(ctx->context, NULL);
     SSL_CTX_free(ctx->context);
     ctx->context = NULL;
   }
+  free_sni(ctx);
+  free_provider(ctx);
+  free_vcache(ctx);
+  free_pins(ctx);
+  free_keyshare(ctx);
+  free_psk(ctx);
+  free_tickets(ctx);
+  free(ctx->hello);
+  ctx->hello = NULL;
+  free(ctx->governor);
+  ctx->governor = NULL;
+  free(ctx->timing);
+  ctx->timing = NULL;
+  free(ctx->latency);
+  ctx->latency = NULL;
+  ctx_clearrefs(L, ctx);
   return 0;
 }
 
@@ -539,6 +2993,8 @@ char ctx_getmode(lua_State *L, int idx)
  */
 int luaopen_ssl_context(lua_State *L)
 {
+  luaL_newmetatable(L, "SSL:Context:Registry");
+  lua_pop(L, 1);
   luaL_newmetatable(L, "SSL:Context");
   lua_newtable(L);
   luaL_register(L, NULL, methods);
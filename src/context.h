@@ -10,6 +10,19 @@
 #include <lua.h>
 #include <openssl/ssl.h>
 
+#include "sni.h"
+#include "provider.h"
+#include "vcache.h"
+#include "keyshare.h"
+#include "psk.h"
+#include "tickets.h"
+#include "hello.h"
+#include "pins.h"
+#include "governor.h"
+#include "iostats.h"
+#include "timing.h"
+#include "latency.h"
+
 #if defined(_WIN32)
 #define LUASEC_API __declspec(dllexport) 
 #else
@@ -20,8 +33,39 @@
 #define MD_CTX_SERVER 1
 #define MD_CTX_CLIENT 2
 
+struct t_store_;
+struct t_crl_;
+struct t_ocsp_;
+struct t_mgroup_;
+
 typedef struct t_context_ {
   SSL_CTX *context;
+  p_sni sni;
+  p_provider provider;
+  struct t_store_ *store;   /* shared trust store, or NULL */
+  p_vcache vcache;          /* verification cache, or NULL */
+  p_pins pins;              /* pinned peer keys, or NULL */
+  struct t_crl_ *crl;       /* shared revocation lists, or NULL */
+  struct t_ocsp_ *ocsp;     /* shared OCSP statuses, or NULL */
+  int ocsprequired;         /* fail without a valid OCSP status */
+  p_keyshare keyshare;      /* key share prediction, or NULL */
+  char *groups;             /* configured groups, or NULL */
+  p_psk psk;                /* pre-shared keys, or NULL */
+  p_tickets tickets;        /* client session store, or NULL */
+  p_hello hello;            /* ClientHello checks, or NULL */
+  p_governor governor;      /* handshake admission, or NULL */
+  size_t certsize;          /* certificate message, uncompressed */
+  size_t certcomp[4];       /* compressed, by RFC 8879 algorithm */
+  int certalgs;             /* algorithms asked for, 1 << RFC 8879 code */
+  unsigned long reloads;
+  unsigned long reloadfailures;
+  double reloadtime;        /* last reload, in seconds */
+  double reloadmax;
+  t_iostats io;             /* counters of the closed connections */
+  unsigned long ioclosed;
+  p_timing timing;          /* handshake phase histograms, or NULL */
+  p_latency latency;        /* latencies of the closed connections */
+  struct t_mgroup_ *metrics; /* exported series, or NULL */
   char mode;
 } t_context;
 typedef t_context* p_context;
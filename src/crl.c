@@ -0,0 +1,888 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "crl.h"
+#include "store.h"
+
+#if defined(CRL_ENABLED)
+
+/* Flags of an indexed entry */
+#define ENTRY_REMOVE    0x01    /* removeFromCRL, in delta CRLs */
+#define ENTRY_NEGATIVE  0x02    /* negative serial number */
+
+#define REASON_REMOVE 8
+
+/* Critical extensions understood, for the CRL and for its entries */
+static const int crl_nids[] = { NID_crl_number, NID_delta_crl, NID_undef };
+static const int entry_nids[] = { NID_crl_reason, NID_undef };
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+static size_t hash(const unsigned char *p, size_t len)
+{
+  size_t h = 2166136261u;
+  while (len-- > 0)
+    h = (h ^ *p++) * 16777619u;
+  return h;
+}
+
+/**
+ * Return 1 if every critical extension of the list is in 'nids'.
+ */
+static int known_critical(const STACK_OF(X509_EXTENSION) *exts,
+  const int *nids)
+{
+  int i, j, nid;
+  X509_EXTENSION *ext;
+  for (i = 0; i < sk_X509_EXTENSION_num(exts); i++) {
+    ext = sk_X509_EXTENSION_value(exts, i);
+    if (!X509_EXTENSION_get_critical(ext))
+      continue;
+    nid = OBJ_obj2nid(X509_EXTENSION_get_object(ext));
+    for (j = 0; nids[j] != NID_undef && nids[j] != nid; j++)
+      ;
+    if (nids[j] == NID_undef)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Read the INTEGER extension 'nid' (cRLNumber, deltaCRLIndicator) into
+ * '*value', -1 if it is absent or too large. Return 0 if it is present
+ * but invalid or repeated.
+ */
+static int crl_number(X509_CRL *crl, int nid, long *value)
+{
+  int crit;
+  int64_t v;
+  ASN1_INTEGER *n = (ASN1_INTEGER*)X509_CRL_get_ext_d2i(crl, nid, &crit,
+    NULL);
+  *value = -1;
+  if (!n)
+    return crit == -1;
+  if (ASN1_INTEGER_get_int64(&v, n) == 1 && v >= 0 && v <= LONG_MAX)
+    *value = (long)v;
+  ASN1_INTEGER_free(n);
+  ERR_clear_error();
+  return 1;
+}
+
+/**
+ * Return 1 if the revoked entry has the removeFromCRL reason.
+ */
+static int entry_removed(X509_REVOKED *rev)
+{
+  int crit;
+  long reason = -1;
+  ASN1_ENUMERATED *e = (ASN1_ENUMERATED*)X509_REVOKED_get_ext_d2i(rev,
+    NID_crl_reason, &crit, NULL);
+  if (e) {
+    reason = ASN1_ENUMERATED_get(e);
+    ASN1_ENUMERATED_free(e);
+  }
+  return reason == REASON_REMOVE;
+}
+
+/**
+ * Find a serial number, return its entry or NULL.
+ */
+static const unsigned char *idx_find(p_crlidx idx, const unsigned char *serial,
+  size_t len, int negative)
+{
+  size_t i;
+  const unsigned char *e;
+  for (i = hash(serial, len) & idx->mask; idx->slots[i]; i = (i + 1) & idx->mask) {
+    e = idx->entries + idx->slots[i] - 1;
+    if (e[1] == len && !memcmp(e + 2, serial, len) &&
+        !(e[0] & ENTRY_NEGATIVE) == !negative)
+      return e;
+  }
+  return NULL;
+}
+
+/**
+ * Check that the signature algorithm is the one in the TBSCertList (RFC
+ * 5280, 5.1.1.2): X509_CRL_verify() does not. 'der' is the encoding 'crl'
+ * was decoded from.
+ */
+static int same_sigalg(X509_CRL *crl, const unsigned char *der, long len)
+{
+  int ok, tag, cls;
+  long n;
+  X509_ALGOR *inner;
+  const X509_ALGOR *outer;
+  const unsigned char *p = der;
+  const unsigned char *end = der + len;
+  /* Into the CertificateList and the TBSCertList, past the version */
+  if ((ASN1_get_object(&p, &n, &tag, &cls, end - p) & 0x80) ||
+      (ASN1_get_object(&p, &n, &tag, &cls, end - p) & 0x80))
+    return 0;
+  if (p < end && *p == V_ASN1_INTEGER) {
+    if (ASN1_get_object(&p, &n, &tag, &cls, end - p) & 0x80)
+      return 0;
+    p += n;
+  }
+  inner = d2i_X509_ALGOR(NULL, &p, end - p);
+  X509_CRL_get0_signature(crl, NULL, &outer);
+  ok = inner && !X509_ALGOR_cmp(inner, outer);
+  X509_ALGOR_free(inner);
+  return ok;
+}
+
+/**
+ * Public key of the CA that issued the CRL, or NULL.
+ */
+static EVP_PKEY *issuer_key(X509_STORE *store, X509_NAME *name)
+{
+  X509 *cert;
+  EVP_PKEY *key = NULL;
+  X509_OBJECT *obj = X509_OBJECT_new();
+  X509_STORE_CTX *ctx = X509_STORE_CTX_new();
+  if (obj && ctx && X509_STORE_CTX_init(ctx, store, NULL, NULL) == 1 &&
+      X509_STORE_CTX_get_by_subject(ctx, X509_LU_X509, name, obj) == 1) {
+    cert = X509_OBJECT_get0_X509(obj);
+    if (!(X509_get_extension_flags(cert) & EXFLAG_KUSAGE) ||
+        (X509_get_key_usage(cert) & KU_CRL_SIGN))
+      key = X509_get_pubkey(cert);
+  }
+  X509_STORE_CTX_free(ctx);
+  X509_OBJECT_free(obj);
+  return key;
+}
+
+/**
+ * Release an index.
+ */
+static void idx_free(p_crlidx idx)
+{
+  if (!idx)
+    return;
+  X509_NAME_free(idx->issuer);
+  ASN1_TIME_free(idx->thisupdate);
+  ASN1_TIME_free(idx->nextupdate);
+  free(idx->slots);
+  free(idx->entries);
+  free(idx);
+}
+
+/**
+ * Check the signature and the extensions of a decoded CRL, and copy
+ * what the checks need.
+ */
+static int idx_header(p_crlidx idx, X509_CRL *crl, const unsigned char *der,
+  long len, X509_STORE *issuers, const char **err)
+{
+  int ok;
+  EVP_PKEY *key;
+  if (!same_sigalg(crl, der, len))
+    return 0;
+  idx->issuer = X509_NAME_dup(X509_CRL_get_issuer(crl));
+  if (!idx->issuer)
+    return 0;
+  key = issuer_key(issuers, idx->issuer);
+  if (!key) {
+    *err = "CRL issuer not found";
+    return 0;
+  }
+  ok = X509_CRL_verify(crl, key) == 1;
+  EVP_PKEY_free(key);
+  if (!ok) {
+    *err = "invalid CRL signature";
+    return 0;
+  }
+  /* issuingDistributionPoint and others are not handled */
+  if (!known_critical(X509_CRL_get0_extensions(crl), crl_nids)) {
+    *err = "unhandled critical CRL extension";
+    return 0;
+  }
+  if (!crl_number(crl, NID_crl_number, &idx->number) ||
+      !crl_number(crl, NID_delta_crl, &idx->base))
+    return 0;
+  /* A delta CRL must not pass for a base */
+  if (idx->base < 0 && X509_CRL_get_ext_by_NID(crl, NID_delta_crl, -1) >= 0)
+    return 0;
+  idx->thisupdate = ASN1_STRING_dup(X509_CRL_get0_lastUpdate(crl));
+  if (!idx->thisupdate)
+    return 0;
+  if (X509_CRL_get0_nextUpdate(crl)) {
+    idx->nextupdate = ASN1_STRING_dup(X509_CRL_get0_nextUpdate(crl));
+    if (!idx->nextupdate)
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Decode and verify a DER CRL, and index its serial numbers. Only the
+ * serial numbers are kept: each entry is a flags byte, the length and
+ * the serial number (magnitude, as in ASN1_INTEGER).
+ */
+static p_crlidx idx_new(const unsigned char *data, size_t datalen,
+  X509_STORE *issuers, const char **err)
+{
+  int i, n;
+  size_t size, cap, len, h;
+  p_crlidx idx;
+  X509_REVOKED *rev;
+  unsigned char *e;
+  const ASN1_INTEGER *serial;
+  STACK_OF(X509_REVOKED) *revoked;
+  const unsigned char *p = data;
+  X509_CRL *crl = d2i_X509_CRL(NULL, &p, (long)datalen);
+
+  *err = "invalid CRL";
+  if (!crl) {
+    ERR_clear_error();
+    return NULL;
+  }
+  idx = (p_crlidx)calloc(1, sizeof(t_crlidx));
+  if (!idx) {
+    X509_CRL_free(crl);
+    *err = "out of memory";
+    return NULL;
+  }
+  idx->number = idx->base = -1;
+  if (!idx_header(idx, crl, data, (long)(p - data), issuers, err))
+    goto error;
+  /* Index the entries */
+  revoked = X509_CRL_get_REVOKED(crl);
+  n = revoked ? sk_X509_REVOKED_num(revoked) : 0;
+  for (i = 0, size = 0; i < n; i++) {
+    rev = sk_X509_REVOKED_value(revoked, i);
+    if (!known_critical(X509_REVOKED_get0_extensions(rev), entry_nids)) {
+      *err = "unhandled critical CRL entry extension";
+      goto error;
+    }
+    len = (size_t)ASN1_STRING_length(X509_REVOKED_get0_serialNumber(rev));
+    if (len == 0 || len > 255)
+      goto error;
+    size += len + 2;
+  }
+  for (cap = 8; cap < 2 * (size_t)n; cap *= 2)
+    ;
+  idx->slots = (size_t*)calloc(cap, sizeof(size_t));
+  idx->entries = (unsigned char*)malloc(size ? size : 1);
+  if (!idx->slots || !idx->entries) {
+    *err = "out of memory";
+    goto error;
+  }
+  idx->mask = cap - 1;
+  for (i = 0, e = idx->entries; i < n; i++) {
+    rev = sk_X509_REVOKED_value(revoked, i);
+    serial = X509_REVOKED_get0_serialNumber(rev);
+    len = (size_t)ASN1_STRING_length(serial);
+    e[0] = 0;
+    if (ASN1_STRING_type(serial) == V_ASN1_NEG_INTEGER)
+      e[0] |= ENTRY_NEGATIVE;
+    /* Only the delta CRLs remove entries */
+    if (idx->base >= 0 && entry_removed(rev))
+      e[0] |= ENTRY_REMOVE;
+    e[1] = (unsigned char)len;
+    memcpy(e + 2, ASN1_STRING_get0_data(serial), len);
+    for (h = hash(e + 2, len) & idx->mask; idx->slots[h];
+         h = (h + 1) & idx->mask)
+      ;
+    idx->slots[h] = (size_t)(e - idx->entries) + 1;
+    idx->count++;
+    e += len + 2;
+  }
+  X509_CRL_free(crl);
+  *err = NULL;
+  return idx;
+error:
+  ERR_clear_error();
+  X509_CRL_free(crl);
+  idx_free(idx);
+  return NULL;
+}
+
+/**
+ * Append an index to the set.
+ */
+static int add_list(p_crl crl, p_crlidx idx)
+{
+  if (crl->nlists == crl->maxlists) {
+    size_t max = crl->maxlists ? crl->maxlists * 2 : 8;
+    p_crlidx *lists = (p_crlidx*)realloc(crl->lists, max * sizeof(p_crlidx));
+    if (!lists)
+      return 0;
+    crl->lists = lists;
+    crl->maxlists = max;
+  }
+  crl->lists[crl->nlists++] = idx;
+  return 1;
+}
+
+/**
+ * Release all lists of the set.
+ */
+static void free_lists(p_crl crl)
+{
+  size_t i;
+  for (i = 0; i < crl->nlists; i++)
+    idx_free(crl->lists[i]);
+  free(crl->lists);
+  crl->lists = NULL;
+  crl->nlists = crl->maxlists = 0;
+}
+
+/**
+ * Index the CRLs of a buffer: one DER CRL, or PEM CRLs.
+ */
+static const char *load_data(p_crl crl, const char *data, size_t len)
+{
+  long n;
+  char *name, *header;
+  unsigned char *der;
+  const char *err = NULL;
+  p_crlidx idx;
+  BIO *bio;
+  if (len < 10 || strncmp(data, "-----BEGIN", 10)) {
+    idx = idx_new((const unsigned char*)data, len, crl->issuers, &err);
+    if (!idx)
+      return err;
+    if (!add_list(crl, idx)) {
+      idx_free(idx);
+      return "out of memory";
+    }
+    return NULL;
+  }
+  bio = BIO_new_mem_buf((void*)data, (int)len);
+  if (!bio)
+    return "out of memory";
+  while (!err && PEM_read_bio(bio, &name, &header, &der, &n)) {
+    if (!strcmp(name, PEM_STRING_X509_CRL)) {
+      idx = idx_new(der, (size_t)n, crl->issuers, &err);
+      if (idx && !add_list(crl, idx)) {
+        idx_free(idx);
+        err = "out of memory";
+      }
+    }
+    OPENSSL_free(name);
+    OPENSSL_free(header);
+    OPENSSL_free(der);
+  }
+  ERR_clear_error();    /* end of the PEM data */
+  BIO_free(bio);
+  return err;
+}
+
+/**
+ * Index the CRLs of a file.
+ */
+static const char *load_file(p_crl crl, const char *path)
+{
+  long len;
+  char *data;
+  const char *err;
+  FILE *fp = fopen(path, "rb");
+  if (!fp)
+    return "error opening CRL file";
+  if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < 0 ||
+      fseek(fp, 0, SEEK_SET) != 0 ||
+      !(data = (char*)malloc((size_t)len + 1))) {
+    fclose(fp);
+    return "error reading CRL file";
+  }
+  if (fread(data, 1, (size_t)len, fp) != (size_t)len) {
+    fclose(fp);
+    free(data);
+    return "error reading CRL file";
+  }
+  fclose(fp);
+  err = load_data(crl, data, (size_t)len);
+  free(data);
+  return err;
+}
+
+/**
+ * CRL files of a directory: "*.crl", "*.pem", "*.der", or the hashed
+ * names of c_rehash ("*.r0").
+ */
+static int is_crlfile(const char *name)
+{
+  const char *ext = strrchr(name, '.');
+  if (!ext)
+    return 0;
+  if (!strcmp(ext, ".crl") || !strcmp(ext, ".pem") || !strcmp(ext, ".der"))
+    return 1;
+  if (ext[1] != 'r' || !ext[2])
+    return 0;
+  for (ext += 2; *ext; ext++) {
+    if (*ext < '0' || *ext > '9')
+      return 0;
+  }
+  return 1;
+}
+
+/**
+ * Index the CRLs of a directory.
+ */
+static const char *load_dir(lua_State *L, p_crl crl, const char *dir)
+{
+  const char *err = NULL;
+#if defined(_WIN32)
+  intptr_t h;
+  struct _finddata_t fd;
+  lua_pushfstring(L, "%s\\*", dir);
+  h = _findfirst(lua_tostring(L, -1), &fd);
+  lua_pop(L, 1);
+  if (h == -1)
+    return "error opening CRL directory";
+  do {
+    if ((fd.attrib & _A_SUBDIR) || !is_crlfile(fd.name))
+      continue;
+    lua_pushfstring(L, "%s\\%s", dir, fd.name);
+    err = load_file(crl, lua_tostring(L, -1));
+    lua_pop(L, 1);
+  } while (!err && _findnext(h, &fd) == 0);
+  _findclose(h);
+#else
+  struct dirent *d;
+  DIR *dp = opendir(dir);
+  if (!dp)
+    return "error opening CRL directory";
+  while (!err && (d = readdir(dp)) != NULL) {
+    if (d->d_name[0] == '.' || !is_crlfile(d->d_name))
+      continue;
+    lua_pushfstring(L, "%s/%s", dir, d->d_name);
+    err = load_file(crl, lua_tostring(L, -1));
+    lua_pop(L, 1);
+  }
+  closedir(dp);
+#endif
+  return err;
+}
+
+/**
+ * Check that the delta CRLs have a base, and drop a delta replaced by a
+ * newer one already in force. The index of 'from' onwards are the new
+ * ones. Base CRLs are all kept: the one in force is chosen at each check.
+ */
+static const char *link_lists(p_crl crl, size_t from)
+{
+  size_t i, j, n;
+  p_crlidx d, b;
+  for (i = from; i < crl->nlists; i++) {
+    d = crl->lists[i];
+    if (d->base < 0)
+      continue;
+    for (j = 0; j < crl->nlists; j++) {
+      b = crl->lists[j];
+      if (b->base < 0 && b->number >= d->base &&
+          !X509_NAME_cmp(b->issuer, d->issuer))
+        break;
+    }
+    if (j == crl->nlists)
+      return "delta CRL without its base";
+  }
+  for (i = 0; i < crl->nlists; i++) {
+    d = crl->lists[i];
+    if (!d || d->base < 0)
+      continue;
+    for (j = 0; j < crl->nlists; j++) {
+      b = crl->lists[j];
+      if (b && b->base >= 0 && b->base <= d->base && b->number > d->number &&
+          X509_cmp_current_time(b->thisupdate) < 0 &&
+          !X509_NAME_cmp(b->issuer, d->issuer)) {
+        crl->lists[i] = NULL;
+        idx_free(d);
+        break;
+      }
+    }
+  }
+  for (i = n = 0; i < crl->nlists; i++) {
+    if (crl->lists[i])
+      crl->lists[n++] = crl->lists[i];
+  }
+  crl->nlists = n;
+  return NULL;
+}
+
+/**
+ * Return the CRL set.
+ */
+static p_crl checkcrl(lua_State *L, int idx)
+{
+  return (p_crl)luaL_checkudata(L, idx, "SSL:CRL");
+}
+
+/**
+ * Index the sources in the table at 'idx' into 'crl': 'file', 'dir', and
+ * 'data' (DER or PEM string). The CRLs are verified with the certificates
+ * of 'store' (an ssl.store) or 'cafile'; without them, with the ones
+ * already in 'crl'.
+ */
+static const char *load(lua_State *L, int idx, p_crl crl)
+{
+  size_t len;
+  const char *file, *dir, *data, *cafile;
+  const char *err = NULL;
+  luaL_checktype(L, idx, LUA_TTABLE);
+  lua_getfield(L, idx, "store");
+  if (!lua_isnil(L, -1)) {
+    X509_STORE_free(crl->issuers);
+    crl->issuers = store_getstore(L, -1)->store;
+    X509_STORE_up_ref(crl->issuers);
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, idx, "cafile");
+  cafile = lua_tostring(L, -1);
+  if (cafile) {
+    X509_STORE_free(crl->issuers);
+    crl->issuers = X509_STORE_new();
+    if (!crl->issuers ||
+        X509_STORE_load_locations(crl->issuers, cafile, NULL) != 1)
+      err = "error loading CRL issuers";
+  }
+  lua_pop(L, 1);
+  if (!err && !crl->issuers)
+    err = "no certificates to verify the CRLs";
+  lua_getfield(L, idx, "file");
+  file = lua_tostring(L, -1);
+  lua_getfield(L, idx, "dir");
+  dir = lua_tostring(L, -1);
+  lua_getfield(L, idx, "data");
+  data = lua_tolstring(L, -1, &len);
+  if (!err && file)
+    err = load_file(crl, file);
+  if (!err && dir)
+    err = load_dir(L, crl, dir);
+  if (!err && data)
+    err = load_data(crl, data, len);
+  lua_pop(L, 3);
+  return err;
+}
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Load and index a set of CRLs, once for every context that uses it.
+ */
+static int create(lua_State *L)
+{
+  const char *err;
+  p_crl crl = (p_crl)lua_newuserdata(L, sizeof(t_crl));
+  memset(crl, 0, sizeof(t_crl));
+  luaL_getmetatable(L, "SSL:CRL");
+  lua_setmetatable(L, -2);
+  err = load(L, 1, crl);
+  if (!err)
+    err = link_lists(crl, 0);
+  if (err) {
+    lua_pushnil(L);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  return 1;
+}
+
+/**
+ * Index a new set of CRLs aside and swap it in. On error, the current
+ * lists are kept.
+ */
+static int reload(lua_State *L)
+{
+  t_crl fresh;
+  const char *err;
+  p_crl crl = checkcrl(L, 1);
+  memset(&fresh, 0, sizeof(t_crl));
+  fresh.issuers = crl->issuers;
+  if (fresh.issuers)
+    X509_STORE_up_ref(fresh.issuers);
+  err = load(L, 2, &fresh);
+  if (!err)
+    err = link_lists(&fresh, 0);
+  if (err) {
+    free_lists(&fresh);
+    X509_STORE_free(fresh.issuers);
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  free_lists(crl);
+  X509_STORE_free(crl->issuers);
+  crl->lists = fresh.lists;
+  crl->nlists = fresh.nlists;
+  crl->maxlists = fresh.maxlists;
+  crl->issuers = fresh.issuers;
+  crl->generation++;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Load delta CRLs only: the indexes of their bases are kept as they are.
+ */
+static int delta(lua_State *L)
+{
+  size_t i;
+  const char *err;
+  p_crl crl = checkcrl(L, 1);
+  size_t from = crl->nlists;
+  err = load(L, 2, crl);
+  for (i = from; !err && i < crl->nlists; i++) {
+    if (crl->lists[i]->base < 0)
+      err = "not a delta CRL";
+  }
+  if (!err)
+    err = link_lists(crl, from);
+  if (err) {
+    for (i = from; i < crl->nlists; i++)
+      idx_free(crl->lists[i]);
+    crl->nlists = from;
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, err);
+    return 2;
+  }
+  crl->generation++;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Return the number of revoked entries indexed, bases and deltas.
+ */
+static int count(lua_State *L)
+{
+  size_t i;
+  double n = 0;
+  p_crl crl = checkcrl(L, 1);
+  for (i = 0; i < crl->nlists; i++)
+    n += crl->lists[i]->count;
+  lua_pushnumber(L, n);
+  return 1;
+}
+
+/**
+ * Return how many times the lists were reloaded or updated.
+ */
+static int generation(lua_State *L)
+{
+  p_crl crl = checkcrl(L, 1);
+  lua_pushnumber(L, crl->generation);
+  return 1;
+}
+
+/**
+ * Package functions
+ */
+static luaL_Reg funcs[] = {
+  {"new",        create},
+  {NULL, NULL}
+};
+
+/*
+ * CRL methods
+ */
+static luaL_Reg methods[] = {
+  {"reload",     reload},
+  {"delta",      delta},
+  {"count",      count},
+  {"generation", generation},
+  {NULL, NULL}
+};
+
+/*-------------------------------- Metamethods -------------------------------*/
+
+/**
+ * Collect the CRL set -- GC metamethod.
+ */
+static int meth_destroy(lua_State *L)
+{
+  p_crl crl = checkcrl(L, 1);
+  free_lists(crl);
+  X509_STORE_free(crl->issuers);
+  crl->issuers = NULL;
+  return 0;
+}
+
+/**
+ * Object information -- tostring metamethod.
+ */
+static int meth_tostring(lua_State *L)
+{
+  p_crl crl = checkcrl(L, 1);
+  lua_pushfstring(L, "SSL CRL: %p", crl);
+  return 1;
+}
+
+/**
+ * CRL metamethods.
+ */
+static luaL_Reg meta[] = {
+  {"__gc",       meth_destroy},
+  {"__tostring", meth_tostring},
+  {NULL, NULL}
+};
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Retrieve the CRL set from the Lua stack.
+ */
+p_crl crl_getcrl(lua_State *L, int idx)
+{
+  return checkcrl(L, idx);
+}
+
+/**
+ * Return X509_V_OK if the CRL is in its validity window, or the error.
+ */
+static int idx_window(p_crlidx idx)
+{
+  int cmp = X509_cmp_current_time(idx->thisupdate);
+  if (cmp == 0)
+    return X509_V_ERR_ERROR_IN_CRL_LAST_UPDATE_FIELD;
+  if (cmp > 0)
+    return X509_V_ERR_CRL_NOT_YET_VALID;
+  if (!idx->nextupdate)
+    return X509_V_OK;
+  cmp = X509_cmp_current_time(idx->nextupdate);
+  if (cmp == 0)
+    return X509_V_ERR_ERROR_IN_CRL_NEXT_UPDATE_FIELD;
+  if (cmp < 0)
+    return X509_V_ERR_CRL_HAS_EXPIRED;
+  return X509_V_OK;
+}
+
+/**
+ * Return 1 if 'a' was issued after 'b': higher cRLNumber, or the same
+ * one and a later thisUpdate.
+ */
+static int idx_newer(p_crlidx a, p_crlidx b)
+{
+  if (a->number != b->number)
+    return a->number > b->number;
+  return ASN1_TIME_compare(a->thisupdate, b->thisupdate) > 0;
+}
+
+/**
+ * Check the certificate against the newest base CRL of its issuer in
+ * force, and its newest delta CRL in force. An entry of the delta has
+ * precedence over the base. If the issuer has CRLs but none in force,
+ * return the error of the window, as the X509 verification does.
+ */
+int crl_revoked(p_crl crl, X509 *cert)
+{
+  int err;
+  size_t i, len;
+  int status = X509_V_OK;
+  const unsigned char *serial, *e;
+  int negative;
+  p_crlidx idx;
+  p_crlidx base = NULL;
+  p_crlidx delta = NULL;
+  const ASN1_INTEGER *sn = X509_get0_serialNumber(cert);
+  X509_NAME *issuer = X509_get_issuer_name(cert);
+  serial = ASN1_STRING_get0_data(sn);
+  len = (size_t)ASN1_STRING_length(sn);
+  negative = ASN1_STRING_type(sn) == V_ASN1_NEG_INTEGER;
+  crl->checks++;
+  for (i = 0; i < crl->nlists; i++) {
+    idx = crl->lists[i];
+    if (idx->base >= 0 || X509_NAME_cmp(idx->issuer, issuer))
+      continue;
+    if ((err = idx_window(idx)) != X509_V_OK)
+      status = err;
+    else if (!base || idx_newer(idx, base))
+      base = idx;
+  }
+  if (!base)
+    return status;
+  for (i = 0; i < crl->nlists; i++) {
+    idx = crl->lists[i];
+    if (idx->base < 0 || idx->base > base->number ||
+        idx->number <= base->number || X509_NAME_cmp(idx->issuer, issuer) ||
+        idx_window(idx) != X509_V_OK)
+      continue;
+    if (!delta || idx_newer(idx, delta))
+      delta = idx;
+  }
+  if (delta && (e = idx_find(delta, serial, len, negative)) != NULL) {
+    if (e[0] & ENTRY_REMOVE)
+      return X509_V_OK;
+    crl->revoked++;
+    return X509_V_ERR_CERT_REVOKED;
+  }
+  if (idx_find(base, serial, len, negative)) {
+    crl->revoked++;
+    return X509_V_ERR_CERT_REVOKED;
+  }
+  return X509_V_OK;
+}
+
+#else
+
+static luaL_Reg funcs[] = {
+  {NULL, NULL}
+};
+
+/**
+ * Indexed CRLs need OpenSSL 1.1.1.
+ */
+static int not_supported(lua_State *L)
+{
+  lua_pushnil(L);
+  lua_pushstring(L, "indexed CRLs not supported");
+  return 2;
+}
+
+p_crl crl_getcrl(lua_State *L, int idx)
+{
+  luaL_argerror(L, idx, "indexed CRLs not supported");
+  return NULL;
+}
+
+int crl_revoked(p_crl crl, X509 *cert)
+{
+  return X509_V_OK;
+}
+
+#endif
+
+/*------------------------------ Initialization ------------------------------*/
+
+/**
+ * Registre the module.
+ */
+LUASEC_API int luaopen_ssl_crl(lua_State *L)
+{
+#if defined(CRL_ENABLED)
+  luaL_newmetatable(L, "SSL:CRL");
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, meta);
+  luaL_register(L, "ssl.crl", funcs);
+#else
+  luaL_register(L, "ssl.crl", funcs);
+  lua_pushcfunction(L, not_supported);
+  lua_setfield(L, -2, "new");
+#endif
+  return 1;
+}
@@ -0,0 +1,57 @@
+#ifndef __CRL_H__
+#define __CRL_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/x509.h>
+#include <lua.h>
+
+#include "context.h"
+
+/* One-shot EVP_DigestVerify() is needed to check the signature */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define CRL_ENABLED
+#endif
+
+/* Index of the serial numbers of one CRL, built when it is loaded: the
+ * decoded CRL is not kept. Every CRL of an issuer is kept: a check uses
+ * the newest base in its validity window, and a delta CRL of that base is
+ * checked before it. */
+typedef struct t_crlidx_ {
+  X509_NAME *issuer;
+  unsigned char *entries;   /* flags, length and serial number */
+  size_t *slots;            /* open addressing: entry offset + 1, or 0 */
+  size_t mask;
+  size_t count;             /* revoked entries */
+  long number;              /* cRLNumber, or -1 */
+  long base;                /* delta CRL: number of its base, else -1 */
+  ASN1_TIME *thisupdate;
+  ASN1_TIME *nextupdate;    /* or NULL */
+} t_crlidx;
+typedef t_crlidx* p_crlidx;
+
+/* Revocation lists shared by reference between contexts */
+typedef struct t_crl_ {
+  p_crlidx *lists;
+  size_t nlists;
+  size_t maxlists;
+  X509_STORE *issuers;      /* certificates that sign the CRLs */
+  unsigned long generation; /* incremented on each reload */
+  unsigned long checks;
+  unsigned long revoked;
+} t_crl;
+typedef t_crl* p_crl;
+
+/* Retrieve the CRL set from the Lua stack */
+p_crl crl_getcrl(lua_State *L, int idx);
+/* Check the certificate against the CRLs of its issuer: X509_V_OK, or
+ * the verification error (revoked, CRL expired...) */
+int crl_revoked(p_crl crl, X509 *cert);
+
+LUASEC_API int luaopen_ssl_crl(lua_State *L);
+
+#endif
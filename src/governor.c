@@ -0,0 +1,206 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include <openssl/ssl.h>
+
+#include "governor.h"
+#include "context.h"
+
+#if defined(GOVERNOR_ENABLED)
+
+/* Place of a connection in the governor of the context that admitted
+ * it. The context keeps a reference, it may be switched by SNI. */
+typedef struct t_govslot_ {
+  SSL_CTX *owner;
+  int waiting;
+  int resumable;            /* admitted without a place */
+} t_govslot;
+
+static int slot_index = -1;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Return the governor of the context, or NULL if the context was
+ * collected or the governor removed.
+ */
+static p_governor get_governor(SSL_CTX *owner)
+{
+  p_context ctx = (p_context)SSL_CTX_get_app_data(owner);
+  return ctx ? ctx->governor : NULL;
+}
+
+/**
+ * Give the place back.
+ */
+static void drop_slot(t_govslot *slot)
+{
+  p_governor g = get_governor(slot->owner);
+  if (g && slot->waiting && g->waiting > 0)
+    g->waiting--;
+  else if (g && !slot->waiting && !slot->resumable && g->active > 0)
+    g->active--;
+  SSL_CTX_free(slot->owner);
+  free(slot);
+}
+
+/**
+ * Release the place of a connection freed during its handshake.
+ */
+static void free_slot(void *parent, void *ptr, CRYPTO_EX_DATA *ad, int idx,
+  long argl, void *argp)
+{
+  if (ptr)
+    drop_slot((t_govslot*)ptr);
+}
+
+/**
+ * Take a place for the connection.
+ */
+static t_govslot *new_slot(SSL *ssl, SSL_CTX *owner, int waiting)
+{
+  t_govslot *slot = (t_govslot*)malloc(sizeof(t_govslot));
+  if (!slot)
+    return NULL;
+  if (!SSL_set_ex_data(ssl, slot_index, slot)) {
+    free(slot);
+    return NULL;
+  }
+  SSL_CTX_up_ref(owner);
+  slot->owner = owner;
+  slot->waiting = waiting;
+  slot->resumable = 0;
+  return slot;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Decide in the ClientHello callback: admit the handshake, defer it (the
+ * application calls dohandshake() again later), or refuse it with an
+ * alert before any expensive work.
+ */
+int governor_admit(p_governor g, SSL *ssl, SSL_CTX *owner, int *al)
+{
+  t_govslot *slot;
+  if (slot_index < 0) {
+    slot_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, free_slot);
+    if (slot_index < 0)
+      return SSL_CLIENT_HELLO_SUCCESS;
+  }
+  slot = (t_govslot*)SSL_get_ex_data(ssl, slot_index);
+  /* Second ClientHello, after a HelloRetryRequest */
+  if (slot && !slot->waiting)
+    return SSL_CLIENT_HELLO_SUCCESS;
+  /* The place is taken in the certificate callback, which only runs if
+     the session is not resumed: the offer alone proves nothing */
+  if (hello_resumable(ssl)) {
+    if (slot) {
+      if (g->waiting > 0)
+        g->waiting--;
+      slot->waiting = 0;
+    } else if ((slot = new_slot(ssl, owner, 0)) == NULL) {
+      *al = SSL_AD_INTERNAL_ERROR;
+      return SSL_CLIENT_HELLO_ERROR;
+    }
+    slot->resumable = 1;
+    g->resumable++;
+    return SSL_CLIENT_HELLO_SUCCESS;
+  }
+  if (g->active < g->maxfull) {
+    if (slot) {
+      if (g->waiting > 0)
+        g->waiting--;
+      slot->waiting = 0;
+    } else if (!new_slot(ssl, owner, 0)) {
+      *al = SSL_AD_INTERNAL_ERROR;
+      return SSL_CLIENT_HELLO_ERROR;
+    }
+    g->active++;
+    g->admitted++;
+    return SSL_CLIENT_HELLO_SUCCESS;
+  }
+  if (slot)
+    return SSL_CLIENT_HELLO_RETRY;
+  if (g->waiting < g->maxwaiting && new_slot(ssl, owner, 1)) {
+    g->waiting++;
+    g->deferred++;
+    return SSL_CLIENT_HELLO_RETRY;
+  }
+  g->shed++;
+  *al = SSL_AD_INTERNAL_ERROR;
+  return SSL_CLIENT_HELLO_ERROR;
+}
+
+/**
+ * Certificate callback of a handshake that is not resumed: a client
+ * admitted as resumable needs a place now. Return 1 to go on, -1 to
+ * defer (SSL_ERROR_WANT_X509_LOOKUP) or 0 to refuse.
+ */
+int governor_full(SSL *ssl)
+{
+  p_governor g;
+  t_govslot *slot;
+  if (slot_index < 0)
+    return 1;
+  slot = (t_govslot*)SSL_get_ex_data(ssl, slot_index);
+  if (!slot || !slot->resumable)
+    return 1;
+  g = get_governor(slot->owner);
+  if (!g)
+    return 1;
+  if (g->active < g->maxfull) {
+    if (slot->waiting && g->waiting > 0)
+      g->waiting--;
+    slot->waiting = 0;
+    slot->resumable = 0;
+    g->active++;
+    g->admitted++;
+    g->notresumed++;
+    return 1;
+  }
+  if (slot->waiting)
+    return -1;
+  if (g->waiting < g->maxwaiting) {
+    slot->waiting = 1;
+    g->waiting++;
+    g->deferred++;
+    return -1;
+  }
+  g->shed++;
+  return 0;
+}
+
+/**
+ * Return 1 if the handshake waits for a place.
+ */
+int governor_waiting(SSL *ssl)
+{
+  t_govslot *slot;
+  if (slot_index < 0)
+    return 0;
+  slot = (t_govslot*)SSL_get_ex_data(ssl, slot_index);
+  return slot && slot->waiting;
+}
+
+/**
+ * The handshake is over, successfully or not: give its place back.
+ */
+void governor_release(SSL *ssl)
+{
+  t_govslot *slot;
+  if (slot_index < 0)
+    return;
+  slot = (t_govslot*)SSL_get_ex_data(ssl, slot_index);
+  if (slot) {
+    SSL_set_ex_data(ssl, slot_index, NULL);
+    drop_slot(slot);
+  }
+}
+
+#endif
@@ -0,0 +1,43 @@
+#ifndef __GOVERNOR_H__
+#define __GOVERNOR_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+
+#include "hello.h"
+
+/* The governor decides in the ClientHello callback */
+#if defined(HELLO_ENABLED)
+#define GOVERNOR_ENABLED
+#endif
+
+/* Server admission control: at most 'maxfull' full handshakes run at the
+ * same time, 'maxwaiting' more are deferred, the others are refused.
+ * Clients offering to resume are admitted, and take a place like the
+ * others if the server does not resume their session. */
+typedef struct t_governor_ {
+  size_t maxfull;
+  size_t maxwaiting;
+  size_t active;            /* full handshakes in progress */
+  size_t waiting;           /* deferred handshakes */
+  unsigned long admitted;   /* full handshakes started */
+  unsigned long resumable;  /* admitted as resumable */
+  unsigned long notresumed; /* of those, given a full handshake */
+  unsigned long deferred;
+  unsigned long shed;
+} t_governor;
+typedef t_governor* p_governor;
+
+#if defined(GOVERNOR_ENABLED)
+int governor_admit(p_governor g, SSL *ssl, SSL_CTX *owner, int *al);
+int governor_full(SSL *ssl);
+int governor_waiting(SSL *ssl);
+void governor_release(SSL *ssl);
+#endif
+
+#endif
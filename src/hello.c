@@ -0,0 +1,264 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <openssl/ssl.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "hello.h"
+
+/* Extension types (RFC 6066, 7301, 8446) */
+#define EXT_SERVER_NAME         0
+#define EXT_ALPN                16
+#define EXT_SESSION_TICKET      35
+#define EXT_PRE_SHARED_KEY      41
+#define EXT_SUPPORTED_VERSIONS  43
+#define EXT_KEY_SHARE           51
+
+typedef struct t_named_ {
+  int id;
+  const char *name;
+} t_named;
+
+static t_named versions[] = {
+  {0x0300, "sslv3"},
+  {0x0301, "tlsv1"},
+  {0x0302, "tlsv1_1"},
+  {0x0303, "tlsv1_2"},
+  {0x0304, "tlsv1_3"},
+  {0, NULL}
+};
+
+#if defined(HELLO_ENABLED)
+/* Names used by OpenSSL for the TLS groups (RFC 8446, 4.2.7) */
+static t_named groups[] = {
+  {0x0017, "P-256"},
+  {0x0018, "P-384"},
+  {0x0019, "P-521"},
+  {0x001D, "X25519"},
+  {0x001E, "X448"},
+  {0x0100, "ffdhe2048"},
+  {0x0101, "ffdhe3072"},
+  {0x0102, "ffdhe4096"},
+  {0x0103, "ffdhe6144"},
+  {0x0104, "ffdhe8192"},
+  {0, NULL}
+};
+#endif
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+#if defined(HELLO_ENABLED)
+
+static unsigned int get16(const unsigned char *p)
+{
+  return ((unsigned int)p[0] << 8) | p[1];
+}
+
+/**
+ * GREASE values (RFC 8701) carry no information.
+ */
+static int is_grease(unsigned int v)
+{
+  return (v & 0x0F0F) == 0x0A0A && (v >> 8) == (v & 0xFF);
+}
+
+static const char *id2name(t_named *list, int id)
+{
+  for (; list->name; list++) {
+    if (list->id == id)
+      return list->name;
+  }
+  return NULL;
+}
+
+/**
+ * Push a name from the list, or the number if it is unknown.
+ */
+static void push_named(lua_State *L, t_named *list, int id)
+{
+  const char *name = id2name(list, id);
+  if (name)
+    lua_pushstring(L, name);
+  else
+    lua_pushnumber(L, id);
+}
+
+static void push_ciphers(lua_State *L, SSL *ssl)
+{
+  size_t i, len;
+  int n = 1;
+  const unsigned char *p;
+  const SSL_CIPHER *c;
+  len = SSL_client_hello_get0_ciphers(ssl, &p);
+  lua_createtable(L, (int)(len / 2), 0);
+  for (i = 0; i + 1 < len; i += 2) {
+    if (is_grease(get16(p + i)))
+      continue;
+    c = SSL_CIPHER_find(ssl, p + i);
+    if (c)
+      lua_pushstring(L, SSL_CIPHER_get_name(c));
+    else
+      lua_pushnumber(L, get16(p + i));
+    lua_rawseti(L, -2, n++);
+  }
+}
+
+static void push_alpn(lua_State *L, SSL *ssl)
+{
+  size_t len, i;
+  int n = 1;
+  const unsigned char *p;
+  lua_newtable(L);
+  if (!SSL_client_hello_get0_ext(ssl, EXT_ALPN, &p, &len) || len < 2)
+    return;
+  len = get16(p) + 2 < len ? get16(p) + 2 : len;
+  for (i = 2; i < len && i + 1 + p[i] <= len; i += 1 + p[i]) {
+    lua_pushlstring(L, (const char*)p + i + 1, p[i]);
+    lua_rawseti(L, -2, n++);
+  }
+}
+
+static void push_versions(lua_State *L, SSL *ssl)
+{
+  size_t len, i;
+  int n = 1;
+  const unsigned char *p;
+  lua_newtable(L);
+  if (SSL_client_hello_get0_ext(ssl, EXT_SUPPORTED_VERSIONS, &p, &len) &&
+      len >= 1) {
+    len = (size_t)p[0] + 1 < len ? (size_t)p[0] + 1 : len;
+    for (i = 1; i + 1 < len; i += 2) {
+      if (is_grease(get16(p + i)))
+        continue;
+      push_named(L, versions, get16(p + i));
+      lua_rawseti(L, -2, n++);
+    }
+  } else {
+    push_named(L, versions, SSL_client_hello_get0_legacy_version(ssl));
+    lua_rawseti(L, -2, n);
+  }
+}
+
+static void push_keyshares(lua_State *L, SSL *ssl)
+{
+  size_t len, i;
+  int n = 1;
+  const unsigned char *p;
+  lua_newtable(L);
+  if (!SSL_client_hello_get0_ext(ssl, EXT_KEY_SHARE, &p, &len) || len < 2)
+    return;
+  len = get16(p) + 2 < len ? get16(p) + 2 : len;
+  /* group (2), key length (2), key */
+  for (i = 2; i + 4 <= len; i += 4 + get16(p + i + 2)) {
+    if (is_grease(get16(p + i)))
+      continue;
+    push_named(L, groups, get16(p + i));
+    lua_rawseti(L, -2, n++);
+  }
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Copy the host name sent by the client to 'name' (SNI_MAXNAME+1 bytes).
+ * Return 0 if there is none.
+ */
+int hello_servername(SSL *ssl, char *name)
+{
+  size_t len, n;
+  const unsigned char *p;
+  if (!SSL_client_hello_get0_ext(ssl, EXT_SERVER_NAME, &p, &len) || len < 5)
+    return 0;
+  /* list length (2), type (1), name length (2), name */
+  n = get16(p + 3);
+  if (p[2] != TLSEXT_NAMETYPE_host_name || n == 0 || n > SNI_MAXNAME ||
+      n + 5 > len)
+    return 0;
+  memcpy(name, p + 5, n);
+  name[n] = '\0';
+  return 1;
+}
+
+/**
+ * Highest protocol version offered by the client.
+ */
+int hello_maxversion(SSL *ssl)
+{
+  size_t len, i;
+  const unsigned char *p;
+  unsigned int v, max = 0;
+  if (SSL_client_hello_get0_ext(ssl, EXT_SUPPORTED_VERSIONS, &p, &len) &&
+      len >= 1) {
+    len = (size_t)p[0] + 1 < len ? (size_t)p[0] + 1 : len;
+    for (i = 1; i + 1 < len; i += 2) {
+      v = get16(p + i);
+      if (!is_grease(v) && v > max)
+        max = v;
+    }
+    if (max)
+      return (int)max;
+  }
+  return (int)SSL_client_hello_get0_legacy_version(ssl);
+}
+
+/**
+ * Return 1 if the client offers to resume a session: a pre-shared key
+ * (TLS 1.3), a session ticket, or a session ID. Clients offering TLS 1.3
+ * send a session ID anyway, for middlebox compatibility, so it is only
+ * counted for older clients.
+ */
+int hello_resumable(SSL *ssl)
+{
+  size_t len;
+  const unsigned char *p;
+  if (SSL_client_hello_get0_ext(ssl, EXT_PRE_SHARED_KEY, &p, &len))
+    return 1;
+  if (SSL_client_hello_get0_ext(ssl, EXT_SESSION_TICKET, &p, &len) &&
+      len > 0)
+    return 1;
+  return hello_maxversion(ssl) < TLS1_3_VERSION &&
+    SSL_client_hello_get0_session_id(ssl, &p) > 0;
+}
+
+/**
+ * Push a table describing the ClientHello: servername, alpn, ciphers,
+ * versions and keyshares.
+ */
+void hello_push(lua_State *L, SSL *ssl)
+{
+  char name[SNI_MAXNAME + 1];
+  lua_createtable(L, 0, 5);
+  if (hello_servername(ssl, name)) {
+    lua_pushstring(L, name);
+    lua_setfield(L, -2, "servername");
+  }
+  push_alpn(L, ssl);
+  lua_setfield(L, -2, "alpn");
+  push_ciphers(L, ssl);
+  lua_setfield(L, -2, "ciphers");
+  push_versions(L, ssl);
+  lua_setfield(L, -2, "versions");
+  push_keyshares(L, ssl);
+  lua_setfield(L, -2, "keyshares");
+}
+#endif
+
+/**
+ * Map a protocol name ("tlsv1_2") to its version number, or 0.
+ */
+int hello_version(const char *name)
+{
+  t_named *v;
+  for (v = versions; v->name; v++) {
+    if (!strcmp(v->name, name))
+      return v->id;
+  }
+  return 0;
+}
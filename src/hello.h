@@ -0,0 +1,39 @@
+#ifndef __HELLO_H__
+#define __HELLO_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+#include <lua.h>
+
+#include "sni.h"
+
+/* The ClientHello callback exists since OpenSSL 1.1.1 */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define HELLO_ENABLED
+#endif
+
+/* Server checks run on the ClientHello, before any expensive work */
+typedef struct t_hello_ {
+  int requiresni;           /* reject clients without a server name */
+  int minversion;           /* reject clients below this version, or 0 */
+  unsigned long accepted;
+  unsigned long rejected;
+  unsigned long switched;   /* context or certificate changed */
+  unsigned long failures;   /* errors in the Lua function */
+} t_hello;
+typedef t_hello* p_hello;
+
+#if defined(HELLO_ENABLED)
+int hello_servername(SSL *ssl, char *name);
+int hello_maxversion(SSL *ssl);
+int hello_resumable(SSL *ssl);
+void hello_push(lua_State *L, SSL *ssl);
+#endif
+int hello_version(const char *name);
+
+#endif
@@ -0,0 +1,178 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include <lua.h>
+
+#include "hist.h"
+
+#define HIST_HALF     (1UL << (HIST_SUBBITS - 1))
+#define HIST_MAXVALUE 0xFFFFFFFFUL
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Position of the highest bit set.
+ */
+static int highbit(unsigned long v)
+{
+  int m = 0;
+  while (v >>= 1)
+    m++;
+  return m;
+}
+
+/**
+ * Bucket of a value, in microseconds.
+ */
+static int bucket(unsigned long v)
+{
+  int m, shift;
+  if (v < (1UL << HIST_SUBBITS))
+    return (int)v;
+  m = highbit(v);
+  shift = m - (HIST_SUBBITS - 1);
+  return (int)((m - HIST_SUBBITS + 1) * HIST_HALF + (v >> shift));
+}
+
+/**
+ * Middle of the values of a bucket, in microseconds.
+ */
+static double bucket_value(int idx)
+{
+  int m, shift;
+  unsigned long sub;
+  if (idx < (1 << HIST_SUBBITS))
+    return idx;
+  m = idx / (int)HIST_HALF - 2 + HIST_SUBBITS;
+  shift = m - (HIST_SUBBITS - 1);
+  sub = (unsigned long)idx % HIST_HALF + HIST_HALF;
+  return (double)(sub << shift) + (double)((1UL << shift) - 1) / 2;
+}
+
+/**
+ * Set a percentile in the table at the top of the stack.
+ */
+static void push_percentile(lua_State *L, const t_hist *h, double p,
+  const char *name)
+{
+  lua_pushnumber(L, hist_percentile(h, p));
+  lua_setfield(L, -2, name);
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Monotonic time, in seconds.
+ */
+double hist_clock(void)
+{
+#if defined(_WIN32)
+  LARGE_INTEGER now, freq;
+  QueryPerformanceCounter(&now);
+  QueryPerformanceFrequency(&freq);
+  return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1.0e9;
+#endif
+}
+
+/**
+ * Record a duration.
+ */
+void hist_add(p_hist h, double seconds)
+{
+  unsigned long us;
+  double v = seconds * 1.0e6;
+  if (v < 0)
+    v = 0;
+  us = v >= (double)HIST_MAXVALUE ? HIST_MAXVALUE : (unsigned long)v;
+  if (h->count == 0 || us < h->min)
+    h->min = us;
+  if (us > h->max)
+    h->max = us;
+  h->count++;
+  h->sum += seconds;
+  h->buckets[bucket(us)]++;
+}
+
+/**
+ * Add the durations of a histogram to another.
+ */
+void hist_merge(p_hist to, const t_hist *from)
+{
+  int i;
+  if (from->count == 0)
+    return;
+  if (to->count == 0 || from->min < to->min)
+    to->min = from->min;
+  if (from->max > to->max)
+    to->max = from->max;
+  to->count += from->count;
+  to->sum += from->sum;
+  for (i = 0; i < HIST_BUCKETS; i++)
+    to->buckets[i] += from->buckets[i];
+}
+
+/**
+ * Return the duration (seconds) below which 'p' percent of the values
+ * fall, within the precision of the buckets.
+ */
+double hist_percentile(const t_hist *h, double p)
+{
+  int i;
+  double v;
+  unsigned long seen = 0;
+  unsigned long rank;
+  if (h->count == 0)
+    return 0;
+  rank = (unsigned long)(p / 100.0 * h->count + 0.5);
+  if (rank < 1)
+    rank = 1;
+  if (rank > h->count)
+    rank = h->count;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank)
+      break;
+  }
+  v = bucket_value(i);
+  if (v < h->min)
+    v = h->min;
+  if (v > h->max)
+    v = h->max;
+  return v / 1.0e6;
+}
+
+/**
+ * Push a table with the count, mean, min, max and main percentiles of
+ * the histogram, in seconds.
+ */
+void hist_push(lua_State *L, const t_hist *h)
+{
+  lua_createtable(L, 0, 8);
+  lua_pushnumber(L, h->count);
+  lua_setfield(L, -2, "count");
+  lua_pushnumber(L, h->count ? h->sum / h->count : 0);
+  lua_setfield(L, -2, "mean");
+  lua_pushnumber(L, h->min / 1.0e6);
+  lua_setfield(L, -2, "min");
+  lua_pushnumber(L, h->max / 1.0e6);
+  lua_setfield(L, -2, "max");
+  push_percentile(L, h, 50, "p50");
+  push_percentile(L, h, 90, "p90");
+  push_percentile(L, h, 99, "p99");
+  push_percentile(L, h, 99.9, "p999");
+}
@@ -0,0 +1,34 @@
+#ifndef __HIST_H__
+#define __HIST_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <lua.h>
+
+/* Log-linear histogram of durations, in the style of HdrHistogram:
+ * exact up to 32 microseconds, then 16 buckets per power of two (6%
+ * precision), up to 2^32 microseconds. Histograms with the same layout
+ * are merged by adding their buckets. */
+#define HIST_SUBBITS   5
+#define HIST_BUCKETS   ((32 - HIST_SUBBITS + 2) << (HIST_SUBBITS - 1))
+
+typedef struct t_hist_ {
+  unsigned long count;
+  double sum;               /* seconds */
+  unsigned long min;        /* microseconds */
+  unsigned long max;
+  unsigned long buckets[HIST_BUCKETS];
+} t_hist;
+typedef t_hist* p_hist;
+
+double hist_clock(void);
+void hist_add(p_hist h, double seconds);
+void hist_merge(p_hist to, const t_hist *from);
+double hist_percentile(const t_hist *h, double p);
+void hist_push(lua_State *L, const t_hist *h);
+
+#endif
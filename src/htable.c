@@ -0,0 +1,183 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "htable.h"
+
+#define HT_MINSIZE 16
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * FNV-1a hash.
+ */
+static unsigned long hash(const void *key, size_t len)
+{
+  const unsigned char *p = (const unsigned char*)key;
+  unsigned long h = 2166136261UL;
+  while (len--) {
+    h ^= *p++;
+    h *= 16777619UL;
+  }
+  return h;
+}
+
+/**
+ * Unlink the node from the recency list.
+ */
+static void unlink_node(p_htable t, p_hnode n)
+{
+  if (n->newer) n->newer->older = n->older;
+  else t->newest = n->older;
+  if (n->older) n->older->newer = n->newer;
+  else t->oldest = n->newer;
+  n->newer = n->older = NULL;
+}
+
+/**
+ * Insert the node as the newest one.
+ */
+static void link_node(p_htable t, p_hnode n)
+{
+  n->newer = NULL;
+  n->older = t->newest;
+  if (t->newest) t->newest->newer = n;
+  else t->oldest = n;
+  t->newest = n;
+}
+
+/**
+ * Double the number of buckets.
+ */
+static void grow(p_htable t)
+{
+  size_t i;
+  size_t size = (t->mask + 1) * 2;
+  p_hnode n, next;
+  p_hnode *buckets = (p_hnode*)calloc(size, sizeof(p_hnode));
+  if (!buckets)
+    return;   /* keep the current size, chains just get longer */
+  for (i = 0; i <= t->mask; i++) {
+    for (n = t->buckets[i]; n; n = next) {
+      next = n->next;
+      n->next = buckets[n->hash & (size - 1)];
+      buckets[n->hash & (size - 1)] = n;
+    }
+  }
+  free(t->buckets);
+  t->buckets = buckets;
+  t->mask = size - 1;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize an empty table.
+ */
+int htable_init(p_htable t, p_hfree free)
+{
+  t->buckets = (p_hnode*)calloc(HT_MINSIZE, sizeof(p_hnode));
+  if (!t->buckets)
+    return 0;
+  t->mask = HT_MINSIZE - 1;
+  t->count = 0;
+  t->newest = t->oldest = NULL;
+  t->free = free;
+  return 1;
+}
+
+/**
+ * Release all nodes, their values and the buckets.
+ */
+void htable_clear(p_htable t)
+{
+  p_hnode n, older;
+  for (n = t->newest; n; n = older) {
+    older = n->older;
+    if (t->free)
+      t->free(n->value);
+    free(n);
+  }
+  free(t->buckets);
+  t->buckets = NULL;
+  t->mask = 0;
+  t->count = 0;
+  t->newest = t->oldest = NULL;
+}
+
+/**
+ * Find the node for a key, or NULL.
+ */
+p_hnode htable_find(p_htable t, const void *key, size_t len)
+{
+  p_hnode n;
+  unsigned long h = hash(key, len);
+  for (n = t->buckets[h & t->mask]; n; n = n->next) {
+    if (n->hash == h && n->len == len && !memcmp(n->key, key, len))
+      return n;
+  }
+  return NULL;
+}
+
+/**
+ * Insert or replace the value for a key. The node becomes the newest one.
+ * Return NULL if there is no memory.
+ */
+p_hnode htable_insert(p_htable t, const void *key, size_t len, void *value)
+{
+  p_hnode n = htable_find(t, key, len);
+  if (n) {
+    if (t->free && n->value != value)
+      t->free(n->value);
+    n->value = value;
+    htable_touch(t, n);
+    return n;
+  }
+  n = (p_hnode)malloc(sizeof(t_hnode) + len);
+  if (!n)
+    return NULL;
+  if (t->count > t->mask)
+    grow(t);
+  n->hash = hash(key, len);
+  n->value = value;
+  n->len = len;
+  memcpy(n->key, key, len);
+  n->key[len] = '\0';
+  n->next = t->buckets[n->hash & t->mask];
+  t->buckets[n->hash & t->mask] = n;
+  link_node(t, n);
+  t->count++;
+  return n;
+}
+
+/**
+ * Remove the node and release its value.
+ */
+void htable_remove(p_htable t, p_hnode n)
+{
+  p_hnode *p = &t->buckets[n->hash & t->mask];
+  while (*p != n)
+    p = &(*p)->next;
+  *p = n->next;
+  unlink_node(t, n);
+  if (t->free)
+    t->free(n->value);
+  free(n);
+  t->count--;
+}
+
+/**
+ * Mark the node as the most recently used.
+ */
+void htable_touch(p_htable t, p_hnode n)
+{
+  if (t->newest != n) {
+    unlink_node(t, n);
+    link_node(t, n);
+  }
+}
@@ -0,0 +1,45 @@
+#ifndef __HTABLE_H__
+#define __HTABLE_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stddef.h>
+
+/* Hash table with binary keys. Nodes are also kept in a recency list,
+ * so the table can be used as an LRU cache. */
+
+typedef void (*p_hfree)(void *value);
+
+typedef struct t_hnode_ {
+  struct t_hnode_ *next;    /* next node in the bucket */
+  struct t_hnode_ *newer;   /* recency list */
+  struct t_hnode_ *older;
+  unsigned long hash;
+  void *value;
+  size_t len;
+  char key[1];
+} t_hnode;
+typedef t_hnode* p_hnode;
+
+typedef struct t_htable_ {
+  p_hnode *buckets;
+  size_t mask;
+  size_t count;
+  p_hnode newest;
+  p_hnode oldest;
+  p_hfree free;             /* release a value, may be NULL */
+} t_htable;
+typedef t_htable* p_htable;
+
+int htable_init(p_htable t, p_hfree free);
+void htable_clear(p_htable t);
+p_hnode htable_find(p_htable t, const void *key, size_t len);
+p_hnode htable_insert(p_htable t, const void *key, size_t len, void *value);
+void htable_remove(p_htable t, p_hnode n);
+void htable_touch(p_htable t, p_hnode n);
+
+#endif
@@ -0,0 +1,62 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <lua.h>
+
+#include "iostats.h"
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Add the counters of a connection to the totals.
+ */
+void iostats_add(p_iostats to, const t_iostats *from)
+{
+  to->sent += from->sent;
+  to->received += from->received;
+  to->writes += from->writes;
+  to->reads += from->reads;
+  to->handshakes += from->handshakes;
+  to->wantread += from->wantread;
+  to->wantwrite += from->wantwrite;
+  to->waits += from->waits;
+  to->waittime += from->waittime;
+}
+
+/**
+ * Set the counters in the table at the top of the stack, the names
+ * starting with 'prefix'.
+ */
+void iostats_push(lua_State *L, const t_iostats *st, const char *prefix)
+{
+  lua_pushfstring(L, "%sbytes_sent", prefix);
+  lua_pushnumber(L, st->sent);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%sbytes_received", prefix);
+  lua_pushnumber(L, st->received);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%swrites", prefix);
+  lua_pushnumber(L, st->writes);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%sreads", prefix);
+  lua_pushnumber(L, st->reads);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%shandshake_calls", prefix);
+  lua_pushnumber(L, st->handshakes);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%swant_read", prefix);
+  lua_pushnumber(L, st->wantread);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%swant_write", prefix);
+  lua_pushnumber(L, st->wantwrite);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%swaits", prefix);
+  lua_pushnumber(L, st->waits);
+  lua_rawset(L, -3);
+  lua_pushfstring(L, "%swait_time", prefix);
+  lua_pushnumber(L, st->waittime);
+  lua_rawset(L, -3);
+}
@@ -0,0 +1,30 @@
+#ifndef __IOSTATS_H__
+#define __IOSTATS_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <lua.h>
+
+/* I/O counters of a connection, or of the closed connections of a
+ * context. Plain increments, the clock is only read before blocking. */
+typedef struct t_iostats_ {
+  double sent;              /* bytes */
+  double received;
+  unsigned long writes;     /* SSL_write() calls */
+  unsigned long reads;      /* SSL_read() calls */
+  unsigned long handshakes; /* SSL_do_handshake() calls */
+  unsigned long wantread;
+  unsigned long wantwrite;
+  unsigned long waits;      /* socket_waitfd() calls that could block */
+  double waittime;          /* seconds in socket_waitfd() */
+} t_iostats;
+typedef t_iostats* p_iostats;
+
+void iostats_add(p_iostats to, const t_iostats *from);
+void iostats_push(lua_State *L, const t_iostats *st, const char *prefix);
+
+#endif
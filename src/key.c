@@ -0,0 +1,228 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "key.h"
+
+/* Where the password callback finds the password */
+typedef struct t_pwsource_ {
+  lua_State *L;
+  int idx;
+} t_pwsource;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Return the key object.
+ */
+static p_key checkkey(lua_State *L, int idx)
+{
+  return (p_key)luaL_checkudata(L, idx, "SSL:Key");
+}
+
+/**
+ * Password callback: a string, or a function returning it.
+ */
+static int passwd_cb(char *buf, int size, int flag, void *udata)
+{
+  size_t len;
+  const char *pw;
+  t_pwsource *src = (t_pwsource*)udata;
+  lua_State *L = src->L;
+  switch (lua_type(L, src->idx)) {
+  case LUA_TFUNCTION:
+    lua_pushvalue(L, src->idx);
+    lua_call(L, 0, 1);
+    break;
+  case LUA_TSTRING:
+    lua_pushvalue(L, src->idx);
+    break;
+  default:
+    return 0;
+  }
+  pw = lua_tolstring(L, -1, &len);
+  if (!pw || lua_type(L, -1) != LUA_TSTRING || size <= 0) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  if (len > (size_t)size)
+    len = (size_t)size;
+  memcpy(buf, pw, len);
+  lua_pop(L, 1);
+  return (int)len;
+}
+
+/**
+ * Return 1 if the data is in PEM format.
+ */
+static int is_pem(const char *data, size_t len)
+{
+  size_t i;
+  static const char tag[] = "-----BEGIN ";
+  for (i = 0; i + sizeof(tag) - 1 <= len; i++) {
+    if (!memcmp(data + i, tag, sizeof(tag) - 1))
+      return 1;
+  }
+  return 0;
+}
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Parse a private key (PEM or DER) once, to be loaded in several contexts
+ * without reading files.
+ */
+static int create(lua_State *L)
+{
+  size_t len;
+  p_key key;
+  EVP_PKEY *pkey;
+  const char *data = luaL_checklstring(L, 1, &len);
+  pkey = key_parse(L, data, len, 2);
+  if (!pkey) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "error loading private key (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  key = (p_key)lua_newuserdata(L, sizeof(t_key));
+  key->pkey = pkey;
+  luaL_getmetatable(L, "SSL:Key");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/**
+ * Return the key algorithm, e.g., "RSA", "id-ecPublicKey" or "ED25519",
+ * and the size in bits.
+ */
+static int info(lua_State *L)
+{
+  p_key key = checkkey(L, 1);
+  lua_pushstring(L, OBJ_nid2sn(EVP_PKEY_base_id(key->pkey)));
+  lua_pushnumber(L, EVP_PKEY_bits(key->pkey));
+  return 2;
+}
+
+/**
+ * Package functions
+ */
+static luaL_Reg funcs[] = {
+  {"new",        create},
+  {NULL, NULL}
+};
+
+/*
+ * Key methods
+ */
+static luaL_Reg methods[] = {
+  {"info",       info},
+  {NULL, NULL}
+};
+
+/*-------------------------------- Metamethods -------------------------------*/
+
+/**
+ * Release our reference -- GC metamethod. Contexts using the key keep
+ * their own.
+ */
+static int meth_destroy(lua_State *L)
+{
+  p_key key = checkkey(L, 1);
+  EVP_PKEY_free(key->pkey);
+  key->pkey = NULL;
+  return 0;
+}
+
+/**
+ * Object information -- tostring metamethod.
+ */
+static int meth_tostring(lua_State *L)
+{
+  p_key key = checkkey(L, 1);
+  lua_pushfstring(L, "SSL key: %p", key);
+  return 1;
+}
+
+/**
+ * Key metamethods.
+ */
+static luaL_Reg meta[] = {
+  {"__gc",       meth_destroy},
+  {"__tostring", meth_tostring},
+  {NULL, NULL}
+};
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Retrieve the key object from the Lua stack.
+ */
+p_key key_getkey(lua_State *L, int idx)
+{
+  p_key key = checkkey(L, idx);
+  if (!key->pkey)
+    luaL_argerror(L, idx, "released key");
+  return key;
+}
+
+/**
+ * Parse a private key from memory: PEM (any type, possibly encrypted),
+ * or DER (traditional, PKCS#8 or encrypted PKCS#8). The password, if
+ * needed, is the string or function at 'pwidx' on the Lua stack.
+ */
+EVP_PKEY *key_parse(lua_State *L, const char *data, size_t len, int pwidx)
+{
+  BIO *bio;
+  t_pwsource src;
+  EVP_PKEY *pkey = NULL;
+  const unsigned char *p = (const unsigned char*)data;
+  if (len > 0x7fffffff)
+    return NULL;
+  src.L = L;
+  src.idx = pwidx;
+  ERR_clear_error();
+  if (!is_pem(data, len)) {
+    pkey = d2i_AutoPrivateKey(NULL, &p, (long)len);
+    if (pkey)
+      return pkey;
+    ERR_clear_error();
+  }
+  bio = BIO_new_mem_buf((void*)data, (int)len);
+  if (!bio)
+    return NULL;
+  if (is_pem(data, len))
+    pkey = PEM_read_bio_PrivateKey(bio, NULL, passwd_cb, &src);
+  else
+    pkey = d2i_PKCS8PrivateKey_bio(bio, NULL, passwd_cb, &src);
+  BIO_free(bio);
+  return pkey;
+}
+
+/*------------------------------ Initialization ------------------------------*/
+
+/**
+ * Registre the module.
+ */
+LUASEC_API int luaopen_ssl_key(lua_State *L)
+{
+  luaL_newmetatable(L, "SSL:Key");
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, meta);
+  luaL_register(L, "ssl.key", funcs);
+  return 1;
+}
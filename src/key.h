@@ -0,0 +1,28 @@
+#ifndef __KEY_H__
+#define __KEY_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/evp.h>
+#include <lua.h>
+
+#include "context.h"
+
+/* Private key parsed once and shared by reference between contexts */
+typedef struct t_key_ {
+  EVP_PKEY *pkey;
+} t_key;
+typedef t_key* p_key;
+
+/* Retrieve the key object from the Lua stack */
+p_key key_getkey(lua_State *L, int idx);
+/* Parse a PEM or DER private key, with the password at 'pwidx' */
+EVP_PKEY *key_parse(lua_State *L, const char *data, size_t len, int pwidx);
+
+LUASEC_API int luaopen_ssl_key(lua_State *L);
+
+#endif
@@ -0,0 +1,146 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/ec.h>
+#include <openssl/objects.h>
+
+#include "keyshare.h"
+
+#if defined(KEYSHARE_ENABLED)
+
+/* Default client groups of OpenSSL 3.0 */
+#define KEYSHARE_DEFAULT "X25519:P-256:X448:P-521:P-384:" \
+  "ffdhe2048:ffdhe3072:ffdhe4096:ffdhe6144:ffdhe8192"
+
+/* ServerHello.random of a HelloRetryRequest (RFC 8446, 4.1.3) */
+static const unsigned char hrr_random[32] = {
+  0xCF, 0x21, 0xAD, 0x74, 0xE5, 0x9A, 0x61, 0x11,
+  0xBE, 0x1D, 0x8C, 0x02, 0x1E, 0x65, 0xB8, 0x91,
+  0xC2, 0xA2, 0x11, 0x16, 0x7A, 0xBB, 0x8C, 0x5E,
+  0x07, 0x9E, 0x09, 0xE2, 0xC8, 0xA8, 0x33, 0x9C
+};
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Map a group name ("P-256", "secp256r1", "X25519", "ffdhe2048") to NID.
+ */
+static int group_nid(const char *name)
+{
+  int nid = EC_curve_nist2nid(name);
+  if (nid == NID_undef)
+    nid = OBJ_sn2nid(name);
+  if (nid == NID_undef)
+    nid = OBJ_ln2nid(name);
+  return nid;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize the memory for at most 'maxdests' destinations.
+ */
+int keyshare_init(p_keyshare ks, size_t maxdests, const char *groups)
+{
+  ks->maxdests = maxdests;
+  ks->predicted = ks->hrr = 0;
+  ks->ngroups = 0;
+  if (!htable_init(&ks->dests, NULL))
+    return 0;
+  keyshare_setgroups(ks, groups);
+  return 1;
+}
+
+/**
+ * Release the memory.
+ */
+void keyshare_free(p_keyshare ks)
+{
+  htable_clear(&ks->dests);
+}
+
+/**
+ * Parse the groups configured in the context (NULL for the default).
+ */
+int keyshare_setgroups(p_keyshare ks, const char *groups)
+{
+  size_t len;
+  char name[64];
+  const char *p = groups ? groups : KEYSHARE_DEFAULT;
+  ks->ngroups = 0;
+  while (*p && ks->ngroups < KEYSHARE_MAXGROUPS) {
+    len = strcspn(p, ":,");
+    if (len > 0 && len < sizeof(name)) {
+      int nid;
+      memcpy(name, p, len);
+      name[len] = '\0';
+      nid = group_nid(name);
+      if (nid != NID_undef)
+        ks->groups[ks->ngroups++] = nid;
+    }
+    p += len;
+    if (*p)
+      p++;
+  }
+  return ks->ngroups > 0;
+}
+
+/**
+ * Before the ClientHello: if the group of the destination is known, move
+ * it to the front of the list, so its key share is the one offered.
+ */
+void keyshare_apply(p_keyshare ks, SSL *ssl, const void *key, size_t len)
+{
+  size_t i, n;
+  int nid;
+  int groups[KEYSHARE_MAXGROUPS];
+  p_hnode node = htable_find(&ks->dests, key, len);
+  if (!node)
+    return;
+  htable_touch(&ks->dests, node);
+  nid = (int)(size_t)node->value;
+  if (ks->ngroups == 0 || ks->groups[0] == nid)
+    return;
+  groups[0] = nid;
+  for (i = 0, n = 1; i < ks->ngroups; i++) {
+    if (ks->groups[i] != nid)
+      groups[n++] = ks->groups[i];
+  }
+  if (n > ks->ngroups)
+    return;   /* the group is no longer configured */
+  if (SSL_set1_groups(ssl, groups, (int)n) == 1)
+    ks->predicted++;
+}
+
+/**
+ * After the handshake: remember the group selected by the server.
+ */
+void keyshare_learn(p_keyshare ks, SSL *ssl, const void *key, size_t len)
+{
+  int nid = SSL_get_negotiated_group(ssl);
+  if (nid <= 0 || (nid & TLSEXT_nid_unknown))
+    return;
+  if (!htable_insert(&ks->dests, key, len, (void*)(size_t)nid))
+    return;
+  while (ks->maxdests && ks->dests.count > ks->maxdests)
+    htable_remove(&ks->dests, ks->dests.oldest);
+}
+
+/**
+ * Check if a handshake message is a HelloRetryRequest.
+ */
+int keyshare_ishrr(const void *buf, size_t len)
+{
+  const unsigned char *msg = (const unsigned char*)buf;
+  /* type (1), length (3), legacy_version (2), random (32) */
+  return len >= 38 && msg[0] == SSL3_MT_SERVER_HELLO &&
+         !memcmp(msg + 6, hrr_random, sizeof(hrr_random));
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef __KEYSHARE_H__
+#define __KEYSHARE_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+
+#include "htable.h"
+
+/* The group selected by a server is only known with OpenSSL 3.0 */
+#if defined(SSL_get_negotiated_group)
+#define KEYSHARE_ENABLED
+#endif
+
+#define KEYSHARE_MAXGROUPS 32
+
+/* Client memory of the group selected by each destination, so the next
+ * ClientHello offers its key share first and avoids a HelloRetryRequest */
+typedef struct t_keyshare_ {
+  t_htable dests;               /* destination -> group NID */
+  size_t maxdests;
+  int groups[KEYSHARE_MAXGROUPS]; /* configured preference */
+  size_t ngroups;
+  unsigned long predicted;      /* handshakes with a predicted group */
+  unsigned long hrr;            /* HelloRetryRequests received */
+} t_keyshare;
+typedef t_keyshare* p_keyshare;
+
+int keyshare_init(p_keyshare ks, size_t maxdests, const char *groups);
+void keyshare_free(p_keyshare ks);
+int keyshare_setgroups(p_keyshare ks, const char *groups);
+void keyshare_apply(p_keyshare ks, SSL *ssl, const void *key, size_t len);
+void keyshare_learn(p_keyshare ks, SSL *ssl, const void *key, size_t len);
+int keyshare_ishrr(const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,36 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <lua.h>
+
+#include "latency.h"
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Add the latencies of a connection to the ones of its context.
+ */
+void latency_merge(p_latency to, const t_latency *from)
+{
+  hist_merge(&to->send, &from->send);
+  hist_merge(&to->receive, &from->receive);
+  hist_merge(&to->handshake, &from->handshake);
+}
+
+/**
+ * Push a table {send = hist, receive = hist, handshake = hist}, each with
+ * the count, mean, min, max and percentiles in seconds.
+ */
+void latency_push(lua_State *L, const t_latency *lat)
+{
+  lua_createtable(L, 0, 3);
+  hist_push(L, &lat->send);
+  lua_setfield(L, -2, "send");
+  hist_push(L, &lat->receive);
+  lua_setfield(L, -2, "receive");
+  hist_push(L, &lat->handshake);
+  lua_setfield(L, -2, "handshake");
+}
@@ -0,0 +1,27 @@
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <lua.h>
+
+#include "hist.h"
+
+/* Latency of the completed send(), receive() and handshakes of a
+ * connection, or of the closed connections of a context. About 11 KB,
+ * allocated only while enabled. */
+typedef struct t_latency_ {
+  t_hist send;
+  t_hist receive;
+  t_hist handshake;
+} t_latency;
+typedef t_latency* p_latency;
+
+void latency_merge(p_latency to, const t_latency *from);
+void latency_push(lua_State *L, const t_latency *lat);
+
+#endif
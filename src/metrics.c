@@ -0,0 +1,347 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include <openssl/ssl.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "metrics.h"
+#include "hist.h"
+
+#define FAMILY_SCALAR      0
+#define FAMILY_HANDSHAKES  1
+#define FAMILY_FAILURES    2
+
+/* Metric family, in the order they are exported */
+typedef struct t_family_ {
+  const char *name;
+  const char *type;
+  const char *help;
+  int kind;
+  size_t offset;            /* of the scalar series in t_mgroup */
+} t_family;
+
+/* Receive the series while walking the registry */
+typedef void (*p_emit)(void *state, const t_family *f, p_mgroup g,
+  const char *k1, const char *v1, const char *k2, const char *v2,
+  p_mseries s);
+
+static const t_family families[] = {
+  {"luasec_connections_open", "gauge",
+   "Connections not closed yet.", FAMILY_SCALAR, offsetof(t_mgroup, open)},
+  {"luasec_connections_total", "counter",
+   "Connections created.", FAMILY_SCALAR, offsetof(t_mgroup, connections)},
+  {"luasec_handshakes_total", "counter",
+   "Completed handshakes, by protocol and cipher.", FAMILY_HANDSHAKES, 0},
+  {"luasec_handshakes_resumed_total", "counter",
+   "Completed handshakes that resumed a session.", FAMILY_SCALAR,
+   offsetof(t_mgroup, resumed)},
+  {"luasec_handshake_failures_total", "counter",
+   "Failed handshakes, by reason.", FAMILY_FAILURES, 0},
+  {"luasec_sent_bytes_total", "counter",
+   "Application bytes sent.", FAMILY_SCALAR, offsetof(t_mgroup, sent)},
+  {"luasec_received_bytes_total", "counter",
+   "Application bytes received.", FAMILY_SCALAR,
+   offsetof(t_mgroup, received)},
+  {NULL, NULL, NULL, 0, 0}
+};
+
+/* The registry: groups in creation order */
+static p_mgroup groups = NULL;
+static p_mgroup *lastgroup = &groups;
+/* Time of the previous snapshot */
+static double snaptime = 0;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Return the series of a key, created with 0 on first use.
+ */
+static p_mseries find_series(p_htable t, const char *key, size_t len)
+{
+  p_mseries s;
+  p_hnode n = htable_find(t, key, len);
+  if (n)
+    return (p_mseries)n->value;
+  s = (p_mseries)calloc(1, sizeof(t_mseries));
+  if (!s)
+    return NULL;
+  if (!htable_insert(t, key, len, s)) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+/**
+ * Walk the series of every group, family by family. Each family starts
+ * with a call without group.
+ */
+static void walk(p_emit emit, void *state)
+{
+  p_mgroup g;
+  p_hnode n;
+  const t_family *f;
+  for (f = families; f->name; f++) {
+    emit(state, f, NULL, NULL, NULL, NULL, NULL, NULL);
+    for (g = groups; g; g = g->next) {
+      switch (f->kind) {
+      case FAMILY_SCALAR:
+        emit(state, f, g, NULL, NULL, NULL, NULL,
+          (p_mseries)((char*)g + f->offset));
+        break;
+      case FAMILY_HANDSHAKES:
+        /* Oldest first: the order of the lines stays stable */
+        for (n = g->handshakes.oldest; n; n = n->newer)
+          emit(state, f, g, "protocol", n->key, "cipher",
+            n->key + strlen(n->key) + 1, (p_mseries)n->value);
+        break;
+      case FAMILY_FAILURES:
+        for (n = g->failures.oldest; n; n = n->newer)
+          emit(state, f, g, "reason", n->key, NULL, NULL,
+            (p_mseries)n->value);
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * Add a label value, escaped for the text format.
+ */
+static void add_escaped(luaL_Buffer *b, const char *s)
+{
+  for ( ; *s; s++) {
+    switch (*s) {
+    case '\\': luaL_addstring(b, "\\\\"); break;
+    case '"':  luaL_addstring(b, "\\\""); break;
+    case '\n': luaL_addstring(b, "\\n");  break;
+    default:   luaL_addchar(b, *s);
+    }
+  }
+}
+
+/**
+ * Add a label, after the context one.
+ */
+static void add_label(luaL_Buffer *b, const char *k, const char *v)
+{
+  luaL_addstring(b, "\",");
+  luaL_addstring(b, k);
+  luaL_addstring(b, "=\"");
+  add_escaped(b, v);
+}
+
+/**
+ * Add the HELP and TYPE lines of a family, or a line
+ * 'name{context="...",k1="v1",k2="v2"} value'.
+ */
+static void emit_text(void *state, const t_family *f, p_mgroup g,
+  const char *k1, const char *v1, const char *k2, const char *v2,
+  p_mseries s)
+{
+  char num[64];
+  luaL_Buffer *b = (luaL_Buffer*)state;
+  if (!g) {
+    luaL_addstring(b, "# HELP ");
+    luaL_addstring(b, f->name);
+    luaL_addchar(b, ' ');
+    luaL_addstring(b, f->help);
+    luaL_addstring(b, "\n# TYPE ");
+    luaL_addstring(b, f->name);
+    luaL_addchar(b, ' ');
+    luaL_addstring(b, f->type);
+    luaL_addchar(b, '\n');
+    return;
+  }
+  luaL_addstring(b, f->name);
+  luaL_addstring(b, "{context=\"");
+  add_escaped(b, g->name);
+  if (k1)
+    add_label(b, k1, v1);
+  if (k2)
+    add_label(b, k2, v2);
+  sprintf(num, "\"} %.15g\n", s->value);
+  luaL_addstring(b, num);
+}
+
+/* State of a snapshot */
+typedef struct t_snapstate_ {
+  lua_State *L;
+  double interval;
+  int n;
+} t_snapstate;
+
+/**
+ * Append {metric, labels, value, delta, rate} to the snapshot table at
+ * the top of the stack, and start the next interval.
+ */
+static void emit_snapshot(void *state, const t_family *f, p_mgroup g,
+  const char *k1, const char *v1, const char *k2, const char *v2,
+  p_mseries s)
+{
+  double delta;
+  t_snapstate *st = (t_snapstate*)state;
+  lua_State *L = st->L;
+  if (!g)
+    return;
+  delta = s->value - s->snap;
+  s->snap = s->value;
+  lua_createtable(L, 0, 5);
+  lua_pushstring(L, f->name);
+  lua_setfield(L, -2, "metric");
+  lua_createtable(L, 0, 3);
+  lua_pushstring(L, g->name);
+  lua_setfield(L, -2, "context");
+  if (k1) {
+    lua_pushstring(L, v1);
+    lua_setfield(L, -2, k1);
+  }
+  if (k2) {
+    lua_pushstring(L, v2);
+    lua_setfield(L, -2, k2);
+  }
+  lua_setfield(L, -2, "labels");
+  lua_pushnumber(L, s->value);
+  lua_setfield(L, -2, "value");
+  lua_pushnumber(L, delta);
+  lua_setfield(L, -2, "delta");
+  lua_pushnumber(L, st->interval > 0 ? delta / st->interval : 0);
+  lua_setfield(L, -2, "rate");
+  lua_rawseti(L, -2, ++st->n);
+}
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Return the series of all the registered contexts in the Prometheus
+ * text format (version 0.0.4).
+ */
+static int render(lua_State *L)
+{
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  walk(emit_text, &b);
+  luaL_pushresult(&b);
+  return 1;
+}
+
+/**
+ * Return the series with their change since the previous snapshot, and
+ * the rate of change per second: {interval = seconds, {metric = name,
+ * labels = {context = ...}, value = v, delta = d, rate = r}, ...}.
+ */
+static int snapshot(lua_State *L)
+{
+  t_snapstate st;
+  double now = hist_clock();
+  st.L = L;
+  st.interval = now - snaptime;
+  st.n = 0;
+  snaptime = now;
+  lua_newtable(L);
+  walk(emit_snapshot, &st);
+  lua_pushnumber(L, st.interval);
+  lua_setfield(L, -2, "interval");
+  return 1;
+}
+
+/**
+ * Package functions
+ */
+static luaL_Reg funcs[] = {
+  {"render",     render},
+  {"snapshot",   snapshot},
+  {NULL, NULL}
+};
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Return the group of a context name, created on first use, or NULL.
+ */
+p_mgroup metrics_group(const char *name)
+{
+  p_mgroup g;
+  for (g = groups; g; g = g->next) {
+    if (!strcmp(g->name, name))
+      return g;
+  }
+  g = (p_mgroup)calloc(1, sizeof(t_mgroup));
+  if (!g)
+    return NULL;
+  if (!htable_init(&g->handshakes, free)) {
+    free(g);
+    return NULL;
+  }
+  if (!htable_init(&g->failures, free)) {
+    htable_clear(&g->handshakes);
+    free(g);
+    return NULL;
+  }
+  strncpy(g->name, name, METRICS_MAXNAME);
+  *lastgroup = g;
+  lastgroup = &g->next;
+  return g;
+}
+
+/**
+ * Count a completed handshake by protocol and cipher.
+ */
+void metrics_handshake(p_mgroup g, SSL *ssl)
+{
+  p_mseries s;
+  char key[128];
+  const char *proto = SSL_get_version(ssl);
+  const char *cipher = SSL_get_cipher_name(ssl);
+  size_t plen = strlen(proto);
+  size_t clen = strlen(cipher);
+  if (plen + clen + 2 > sizeof(key))
+    return;
+  memcpy(key, proto, plen + 1);
+  memcpy(key + plen + 1, cipher, clen + 1);
+  s = find_series(&g->handshakes, key, plen + clen + 1);
+  if (s)
+    s->value++;
+  if (SSL_session_reused(ssl))
+    g->resumed.value++;
+}
+
+/**
+ * Count a failed handshake. The reasons beyond METRICS_MAXREASONS are
+ * counted together, to bound the size of the registry.
+ */
+void metrics_failure(p_mgroup g, const char *reason)
+{
+  p_mseries s;
+  if (!reason)
+    reason = "unknown";
+  if (g->failures.count >= METRICS_MAXREASONS &&
+      !htable_find(&g->failures, reason, strlen(reason)))
+    reason = "other";
+  s = find_series(&g->failures, reason, strlen(reason));
+  if (s)
+    s->value++;
+}
+
+/*------------------------------ Initialization ------------------------------*/
+
+/**
+ * Registre the module.
+ */
+LUASEC_API int luaopen_ssl_metrics(lua_State *L)
+{
+  if (snaptime == 0)
+    snaptime = hist_clock();
+  luaL_register(L, "ssl.metrics", funcs);
+  return 1;
+}
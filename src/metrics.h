@@ -0,0 +1,50 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+#include <lua.h>
+
+#include "htable.h"
+#include "context.h"
+
+#define METRICS_MAXNAME     64
+#define METRICS_MAXREASONS  64    /* then counted as "other" */
+
+/* Value of a series, and its value at the previous snapshot */
+typedef struct t_mseries_ {
+  double value;
+  double snap;
+} t_mseries;
+typedef t_mseries* p_mseries;
+
+/* Series of the contexts registered under one name. Groups live as long
+ * as the process, so connections keep a plain pointer to theirs and
+ * counters never go back when a context is collected. */
+typedef struct t_mgroup_ {
+  char name[METRICS_MAXNAME + 1];
+  t_mseries open;           /* live connections */
+  t_mseries connections;
+  t_mseries resumed;
+  t_mseries sent;           /* bytes */
+  t_mseries received;
+  t_htable handshakes;      /* "protocol\0cipher" -> t_mseries */
+  t_htable failures;        /* reason -> t_mseries */
+  struct t_mgroup_ *next;
+} t_mgroup;
+typedef t_mgroup* p_mgroup;
+
+/* Group of a context name, created on first use */
+p_mgroup metrics_group(const char *name);
+/* A handshake completed, or failed for 'reason' */
+void metrics_handshake(p_mgroup g, SSL *ssl);
+void metrics_failure(p_mgroup g, const char *reason);
+
+LUASEC_API int luaopen_ssl_metrics(lua_State *L);
+
+#endif
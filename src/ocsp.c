@@ -0,0 +1,372 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/ocsp.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "ocsp.h"
+
+#if defined(OCSP_ENABLED)
+
+/* Clock skew accepted on thisUpdate and nextUpdate, in seconds */
+#define OCSP_LEEWAY 300
+
+/* Largest DER certificate ID: SHA-1 hashes and a 20-byte serial */
+#define OCSP_MAXID 128
+
+/* Cached status */
+typedef struct t_ocspentry_ {
+  time_t expires;           /* nextUpdate of the response */
+  int status;               /* V_OCSP_CERTSTATUS_* */
+} t_ocspentry;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Return the OCSP cache.
+ */
+static p_ocsp checkocsp(lua_State *L, int idx)
+{
+  return (p_ocsp)luaL_checkudata(L, idx, "SSL:OCSP");
+}
+
+/**
+ * Find the issuer of the peer certificate: in the verified chain, in the
+ * certificates sent by the peer (pinned or cached verifications do not
+ * build a chain), or in the trust store.
+ */
+static X509 *find_issuer(SSL *ssl, STACK_OF(X509) *peer, X509 *cert)
+{
+  int i;
+  X509 *issuer = NULL;
+  X509_STORE_CTX *x509ctx;
+  STACK_OF(X509) *chain = SSL_get0_verified_chain(ssl);
+  if (chain && sk_X509_num(chain) > 1) {
+    issuer = sk_X509_value(chain, 1);
+    X509_up_ref(issuer);
+    return issuer;
+  }
+  for (i = 0; i < sk_X509_num(peer); i++) {
+    issuer = sk_X509_value(peer, i);
+    if (issuer != cert && X509_check_issued(issuer, cert) == X509_V_OK) {
+      X509_up_ref(issuer);
+      return issuer;
+    }
+  }
+  issuer = NULL;
+  x509ctx = X509_STORE_CTX_new();
+  if (x509ctx && X509_STORE_CTX_init(x509ctx,
+        SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl)), cert, NULL) == 1) {
+    if (X509_STORE_CTX_get1_issuer(&issuer, x509ctx, cert) != 1)
+      issuer = NULL;
+  }
+  X509_STORE_CTX_free(x509ctx);
+  return issuer;
+}
+
+/**
+ * Seconds from now to the ASN.1 time, or -1 if it is in the past.
+ */
+static long time_left(const ASN1_GENERALIZEDTIME *t)
+{
+  int days, secs;
+  if (!ASN1_TIME_diff(&days, &secs, NULL, t) || days < 0 || secs < 0)
+    return -1;
+  return (long)days * 86400 + secs;
+}
+
+/**
+ * Cache the status until the nextUpdate of the response. Responses
+ * without nextUpdate are not cached: newer information is always
+ * available from the responder (RFC 6960, 4.2.2.1).
+ */
+static void add_entry(p_ocsp oc, const unsigned char *key, size_t len,
+  int status, const ASN1_GENERALIZEDTIME *nextupd)
+{
+  long left;
+  t_ocspentry *e;
+  if (!nextupd || (left = time_left(nextupd)) <= 0)
+    return;
+  e = (t_ocspentry*)malloc(sizeof(t_ocspentry));
+  if (!e)
+    return;
+  e->expires = time(NULL) + left;
+  e->status = status;
+  if (!htable_insert(&oc->entries, key, len, e)) {
+    free(e);
+    return;
+  }
+  while (oc->maxentries && oc->entries.count > oc->maxentries)
+    htable_remove(&oc->entries, oc->entries.oldest);
+}
+
+/**
+ * Return the cached status, or -1.
+ */
+static int find_entry(p_ocsp oc, const unsigned char *key, size_t len)
+{
+  p_hnode n = htable_find(&oc->entries, key, len);
+  if (!n)
+    return -1;
+  if (((t_ocspentry*)n->value)->expires <= time(NULL)) {
+    htable_remove(&oc->entries, n);
+    return -1;
+  }
+  htable_touch(&oc->entries, n);
+  return ((t_ocspentry*)n->value)->status;
+}
+
+/**
+ * Verify the stapled response and return the status of the certificate,
+ * or -1 if the response is invalid.
+ */
+static int verify_staple(p_ocsp oc, SSL *ssl, const unsigned char *der,
+  long len, OCSP_CERTID *id, STACK_OF(X509) *peer,
+  const unsigned char *key, size_t keylen)
+{
+  int status = -1;
+  int reason;
+  ASN1_GENERALIZEDTIME *rev, *thisupd, *nextupd;
+  OCSP_BASICRESP *bs = NULL;
+  OCSP_RESPONSE *resp = d2i_OCSP_RESPONSE(NULL, &der, len);
+  if (!resp || OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL)
+    goto done;
+  bs = OCSP_response_get1_basic(resp);
+  /* Signed by the issuer or by a responder it delegated */
+  if (!bs || OCSP_basic_verify(bs, peer,
+        SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl)), 0) <= 0)
+    goto done;
+  if (!OCSP_resp_find_status(bs, id, &status, &reason, &rev, &thisupd,
+        &nextupd) ||
+      !OCSP_check_validity(thisupd, nextupd, OCSP_LEEWAY, -1)) {
+    status = -1;
+    goto done;
+  }
+  add_entry(oc, key, keylen, status, nextupd);
+done:
+  OCSP_BASICRESP_free(bs);
+  OCSP_RESPONSE_free(resp);
+  return status;
+}
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Create a cache of at most 'maxentries' statuses (1024 by default, 0
+ * for no limit), to be shared by the client contexts.
+ */
+static int create(lua_State *L)
+{
+  p_ocsp oc;
+  lua_Number n = luaL_optnumber(L, 1, 1024);
+  luaL_argcheck(L, n >= 0, 1, "invalid cache size");
+  oc = (p_ocsp)lua_newuserdata(L, sizeof(t_ocsp));
+  memset(oc, 0, sizeof(t_ocsp));
+  if (!htable_init(&oc->entries, free)) {
+    lua_pushnil(L);
+    lua_pushstring(L, "error creating OCSP cache");
+    return 2;
+  }
+  oc->maxentries = (size_t)n;
+  luaL_getmetatable(L, "SSL:OCSP");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/**
+ * Return the number of cached statuses.
+ */
+static int count(lua_State *L)
+{
+  p_ocsp oc = checkocsp(L, 1);
+  lua_pushnumber(L, oc->entries.count);
+  return 1;
+}
+
+/**
+ * Drop all cached statuses.
+ */
+static int flush(lua_State *L)
+{
+  p_ocsp oc = checkocsp(L, 1);
+  while (oc->entries.oldest)
+    htable_remove(&oc->entries, oc->entries.oldest);
+  return 0;
+}
+
+/**
+ * Package functions
+ */
+static luaL_Reg funcs[] = {
+  {"new",        create},
+  {NULL, NULL}
+};
+
+/*
+ * OCSP cache methods
+ */
+static luaL_Reg methods[] = {
+  {"count",      count},
+  {"flush",      flush},
+  {NULL, NULL}
+};
+
+/*-------------------------------- Metamethods -------------------------------*/
+
+/**
+ * Collect the OCSP cache -- GC metamethod.
+ */
+static int meth_destroy(lua_State *L)
+{
+  p_ocsp oc = checkocsp(L, 1);
+  htable_clear(&oc->entries);
+  return 0;
+}
+
+/**
+ * Object information -- tostring metamethod.
+ */
+static int meth_tostring(lua_State *L)
+{
+  p_ocsp oc = checkocsp(L, 1);
+  lua_pushfstring(L, "SSL OCSP cache: %p", oc);
+  return 1;
+}
+
+/**
+ * OCSP cache metamethods.
+ */
+static luaL_Reg meta[] = {
+  {"__gc",       meth_destroy},
+  {"__tostring", meth_tostring},
+  {NULL, NULL}
+};
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Retrieve the OCSP cache from the Lua stack.
+ */
+p_ocsp ocsp_getcache(lua_State *L, int idx)
+{
+  return checkocsp(L, idx);
+}
+
+/**
+ * Check the status of the peer certificate: a stapled response is
+ * verified and cached; without one, a cached status is used.
+ */
+int ocsp_check(p_ocsp oc, SSL *ssl)
+{
+  int status;
+  int ret = OCSP_CHECK_INVALID;
+  long len;
+  size_t keylen;
+  X509 *cert, *issuer = NULL;
+  OCSP_CERTID *id = NULL;
+  unsigned char key[OCSP_MAXID];
+  unsigned char *p = key;
+  const unsigned char *der = NULL;
+  STACK_OF(X509) *peer = SSL_get_peer_cert_chain(ssl);
+  /* On the client, the chain starts with the peer certificate */
+  if (!peer || sk_X509_num(peer) == 0)
+    return OCSP_CHECK_INVALID;
+  cert = sk_X509_value(peer, 0);
+  issuer = find_issuer(ssl, peer, cert);
+  if (!issuer || !(id = OCSP_cert_to_id(NULL, cert, issuer)) ||
+      i2d_OCSP_CERTID(id, NULL) > OCSP_MAXID)
+    goto done;
+  keylen = (size_t)i2d_OCSP_CERTID(id, &p);
+  len = SSL_get_tlsext_status_ocsp_resp(ssl, &der);
+  if (der && len > 0) {
+    status = verify_staple(oc, ssl, der, len, id, peer, key, keylen);
+    if (status < 0) {
+      oc->invalid++;
+      goto done;
+    }
+    oc->stapled++;
+  } else if ((status = find_entry(oc, key, keylen)) >= 0) {
+    oc->hits++;
+  } else {
+    oc->misses++;
+    ret = OCSP_CHECK_NONE;
+    goto done;
+  }
+  switch (status) {
+  case V_OCSP_CERTSTATUS_GOOD:
+    ret = OCSP_CHECK_GOOD;
+    break;
+  case V_OCSP_CERTSTATUS_REVOKED:
+    oc->revoked++;
+    ret = OCSP_CHECK_REVOKED;
+    break;
+  default:
+    ret = OCSP_CHECK_UNKNOWN;
+  }
+done:
+  OCSP_CERTID_free(id);
+  X509_free(issuer);
+  return ret;
+}
+
+#else
+
+static luaL_Reg funcs[] = {
+  {NULL, NULL}
+};
+
+/**
+ * OCSP stapling on the client needs OpenSSL 1.1.0.
+ */
+static int not_supported(lua_State *L)
+{
+  lua_pushnil(L);
+  lua_pushstring(L, "OCSP cache not supported");
+  return 2;
+}
+
+p_ocsp ocsp_getcache(lua_State *L, int idx)
+{
+  luaL_argerror(L, idx, "OCSP cache not supported");
+  return NULL;
+}
+
+int ocsp_check(p_ocsp oc, SSL *ssl)
+{
+  return OCSP_CHECK_NONE;
+}
+
+#endif
+
+/*------------------------------ Initialization ------------------------------*/
+
+/**
+ * Registre the module.
+ */
+LUASEC_API int luaopen_ssl_ocsp(lua_State *L)
+{
+#if defined(OCSP_ENABLED)
+  luaL_newmetatable(L, "SSL:OCSP");
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, meta);
+  luaL_register(L, "ssl.ocsp", funcs);
+#else
+  luaL_register(L, "ssl.ocsp", funcs);
+  lua_pushcfunction(L, not_supported);
+  lua_setfield(L, -2, "new");
+#endif
+  return 1;
+}
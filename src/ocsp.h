@@ -0,0 +1,49 @@
+#ifndef __OCSP_H__
+#define __OCSP_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+#include <lua.h>
+
+#include "htable.h"
+#include "context.h"
+
+/* Stapling on the client and the OCSP accessors need OpenSSL 1.1.0 */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(OPENSSL_NO_OCSP)
+#define OCSP_ENABLED
+#endif
+
+/* Result of ocsp_check() */
+#define OCSP_CHECK_GOOD     0
+#define OCSP_CHECK_NONE     1   /* no staple nor cached status */
+#define OCSP_CHECK_UNKNOWN  2   /* the responder does not know the cert */
+#define OCSP_CHECK_REVOKED  3
+#define OCSP_CHECK_INVALID  4   /* bad or expired stapled response */
+
+/* Verified OCSP statuses, keyed by the DER of the certificate ID and
+ * kept until the nextUpdate of the response. Shared by reference between
+ * contexts. */
+typedef struct t_ocsp_ {
+  t_htable entries;
+  size_t maxentries;
+  unsigned long stapled;    /* verified stapled responses */
+  unsigned long hits;       /* status taken from the cache */
+  unsigned long misses;     /* no staple and nothing cached */
+  unsigned long revoked;
+  unsigned long invalid;
+} t_ocsp;
+typedef t_ocsp* p_ocsp;
+
+/* Retrieve the OCSP cache from the Lua stack */
+p_ocsp ocsp_getcache(lua_State *L, int idx);
+/* Check the stapled response of the connection, or the cached status */
+int ocsp_check(p_ocsp oc, SSL *ssl);
+
+LUASEC_API int luaopen_ssl_ocsp(lua_State *L);
+
+#endif
@@ -0,0 +1,116 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <ctype.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "pins.h"
+
+/* Base64 of a SHA-256 digest, with padding */
+#define PINS_B64LEN 44
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+static int hexval(int c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/**
+ * Decode a pin: 32 raw bytes, 64 hex digits, or base64, optionally with
+ * the "sha256/" prefix (as in HPKP and curl --pinnedpubkey).
+ */
+static int decode(const char *pin, size_t len, unsigned char *md)
+{
+  size_t i;
+  unsigned char buf[PINS_B64LEN];
+  if (len > 7 && !memcmp(pin, "sha256/", 7)) {
+    pin += 7;
+    len -= 7;
+  }
+  if (len == PINS_MDLEN) {
+    memcpy(md, pin, PINS_MDLEN);
+    return 1;
+  }
+  if (len == 2 * PINS_MDLEN) {
+    for (i = 0; i < PINS_MDLEN; i++) {
+      int hi = hexval((unsigned char)pin[2*i]);
+      int lo = hexval((unsigned char)pin[2*i+1]);
+      if (hi < 0 || lo < 0)
+        return 0;
+      md[i] = (unsigned char)(hi << 4 | lo);
+    }
+    return 1;
+  }
+  /* One '=' of padding: 33 decoded bytes, the last one is zero */
+  if (len == PINS_B64LEN && pin[len-1] == '=' && pin[len-2] != '=') {
+    if (EVP_DecodeBlock(buf, (const unsigned char*)pin, (int)len) != 33)
+      return 0;
+    memcpy(md, buf, PINS_MDLEN);
+    return 1;
+  }
+  return 0;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize an empty pin set.
+ */
+int pins_init(p_pins p, int chain)
+{
+  p->chain = chain;
+  p->hits = p->misses = 0;
+  return htable_init(&p->set, NULL);
+}
+
+/**
+ * Release the pin set.
+ */
+void pins_free(p_pins p)
+{
+  htable_clear(&p->set);
+}
+
+/**
+ * Add a pin. Return 0 if it is not a valid SHA-256 digest.
+ */
+int pins_add(p_pins p, const char *pin, size_t len)
+{
+  unsigned char md[PINS_MDLEN];
+  if (!decode(pin, len, md))
+    return 0;
+  return htable_insert(&p->set, md, PINS_MDLEN, p) != NULL;
+}
+
+/**
+ * Check if the public key of the certificate is pinned.
+ */
+int pins_check(p_pins p, X509 *cert)
+{
+  int len;
+  unsigned char *der = NULL;
+  unsigned char md[PINS_MDLEN];
+  /* The digest covers the whole DER SubjectPublicKeyInfo */
+  len = i2d_X509_PUBKEY(X509_get_X509_PUBKEY(cert), &der);
+  if (len <= 0 || !EVP_Digest(der, (size_t)len, md, NULL, EVP_sha256(), NULL) ||
+      !htable_find(&p->set, md, PINS_MDLEN)) {
+    OPENSSL_free(der);
+    p->misses++;
+    return 0;
+  }
+  OPENSSL_free(der);
+  p->hits++;
+  return 1;
+}
@@ -0,0 +1,30 @@
+#ifndef __PINS_H__
+#define __PINS_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/x509.h>
+
+#include "htable.h"
+
+#define PINS_MDLEN 32
+
+/* Set of SHA-256 digests of the SubjectPublicKeyInfo of trusted peers */
+typedef struct t_pins_ {
+  t_htable set;
+  int chain;                /* also verify the chain against the CAs */
+  unsigned long hits;
+  unsigned long misses;
+} t_pins;
+typedef t_pins* p_pins;
+
+int pins_init(p_pins p, int chain);
+void pins_free(p_pins p);
+int pins_add(p_pins p, const char *pin, size_t len);
+int pins_check(p_pins p, X509 *cert);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+/* USDT probes of the provider "luasec", for perf, bpftrace or SystemTap.
+ * Built with -DLUASEC_USDT and <sys/sdt.h> (systemtap-sdt-dev); each
+ * probe is then a nop until a tracer attaches. Otherwise they compile to
+ * nothing.
+ *
+ *   handshake_start(ssl, fd)              a dohandshake() call
+ *   handshake_end(ssl, err, sslerr)
+ *   send_entry(ssl, count)                ssl_send()
+ *   send_return(ssl, sent, err, sslerr)
+ *   recv_entry(ssl, count)                ssl_recv()
+ *   recv_return(ssl, got, err, sslerr)
+ *   wait_block(ssl, fd, what)             socket_waitfd() may block
+ *   wait_wake(ssl, fd, err)
+ *   session_hit(ssl, server)              the handshake resumed a session
+ *   session_miss(ssl, server)             it did not
+ *
+ * 'err' is an IO_* code, 'sslerr' an SSL_ERROR_* code. */
+#if defined(LUASEC_USDT)
+#include <sys/sdt.h>
+#define LUASEC_PROBE2(name, a, b)        DTRACE_PROBE2(luasec, name, a, b)
+#define LUASEC_PROBE3(name, a, b, c)     DTRACE_PROBE3(luasec, name, a, b, c)
+#define LUASEC_PROBE4(name, a, b, c, d)  DTRACE_PROBE4(luasec, name, a, b, c, d)
+#else
+#define LUASEC_PROBE2(name, a, b)        ((void)0)
+#define LUASEC_PROBE3(name, a, b, c)     ((void)0)
+#define LUASEC_PROBE4(name, a, b, c, d)  ((void)0)
+#endif
+
+#endif
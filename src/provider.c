@@ -0,0 +1,293 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "sni.h"
+#include "provider.h"
+
+#if defined(PROVIDER_ENABLED)
+
+/* Entry returned for the unknown names */
+static t_provent unknown_entry = {NULL, 0};
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Release a cache entry (hash table callback).
+ */
+static void free_entry(void *value)
+{
+  p_provent e = (p_provent)value;
+  if (e->context)
+    SSL_CTX_free(e->context);
+  free(e);
+}
+
+/**
+ * Estimate the memory held by a context: DER size of the certificates
+ * and the keys.
+ */
+static size_t ctx_size(SSL_CTX *ctx)
+{
+  int i, more;
+  size_t size = 0;
+  X509 *cert;
+  EVP_PKEY *key;
+  STACK_OF(X509) *chain;
+  more = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+  for ( ; more; more = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+    cert = SSL_CTX_get0_certificate(ctx);
+    key = SSL_CTX_get0_privatekey(ctx);
+    chain = NULL;
+    if (cert)
+      size += i2d_X509(cert, NULL);
+    if (key)
+      size += i2d_PrivateKey(key, NULL);
+    if (SSL_CTX_get0_chain_certs(ctx, &chain) && chain) {
+      for (i = 0; i < sk_X509_num(chain); i++)
+        size += i2d_X509(sk_X509_value(chain, i), NULL);
+    }
+  }
+  return size;
+}
+
+/**
+ * Drop the least recently used entries until the limits are respected.
+ */
+static void evict(p_provider p)
+{
+  p_hnode n;
+  while ((n = p->cache.oldest) != NULL &&
+         ((p->maxentries && p->cache.count > p->maxentries) ||
+          (p->maxbytes && p->bytes > p->maxbytes))) {
+    p->bytes -= ((p_provent)n->value)->size;
+    htable_remove(&p->cache, n);
+    p->evictions++;
+  }
+}
+
+/**
+ * Accept only host names as file names: no path separators and no
+ * leading or repeated dots.
+ */
+static int valid_filename(const char *name)
+{
+  const char *c;
+  if (*name == '.')
+    return 0;
+  for (c = name; *c; c++) {
+    if (*c == '/' || *c == '\\' || (*c == '.' && c[1] == '.'))
+      return 0;
+  }
+  return 1;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize the provider.
+ */
+int provider_init(p_provider p, const char *dir, size_t maxentries,
+  size_t maxbytes, int async)
+{
+  memset(p, 0, sizeof(t_provider));
+  if (dir) {
+    p->dir = (char*)malloc(strlen(dir) + 1);
+    if (!p->dir)
+      return 0;
+    strcpy(p->dir, dir);
+  }
+  p->async = async;
+  p->maxentries = maxentries;
+  p->maxbytes = maxbytes;
+  if (!htable_init(&p->cache, free_entry)) {
+    free(p->dir);
+    p->dir = NULL;
+    return 0;
+  }
+  if (!htable_init(&p->unknown, NULL)) {
+    htable_clear(&p->cache);
+    free(p->dir);
+    p->dir = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Release the provider and its cached contexts.
+ */
+void provider_free(p_provider p)
+{
+  htable_clear(&p->cache);
+  htable_clear(&p->unknown);
+  free(p->dir);
+  p->dir = NULL;
+}
+
+/**
+ * Look up a server name and count a hit or a miss.
+ */
+p_provent provider_get(p_provider p, const char *name)
+{
+  p_hnode n;
+  char buf[SNI_MAXNAME+1];
+  size_t len = sni_normalize(name, buf);
+  if (len == 0)
+    return NULL;
+  n = htable_find(&p->cache, buf, len);
+  if (n) {
+    htable_touch(&p->cache, n);
+    p->hits++;
+    return (p_provent)n->value;
+  }
+  n = htable_find(&p->unknown, buf, len);
+  if (n) {
+    htable_touch(&p->unknown, n);
+    p->hits++;
+    return &unknown_entry;
+  }
+  p->misses++;
+  return NULL;
+}
+
+/**
+ * Remember that a server name is unknown, dropping the oldest unknown
+ * name beyond PROVIDER_MAXUNKNOWN.
+ */
+static p_provent put_unknown(p_provider p, const char *key, size_t len)
+{
+  p_hnode n = htable_find(&p->cache, key, len);
+  if (n) {
+    p->bytes -= ((p_provent)n->value)->size;
+    htable_remove(&p->cache, n);
+  }
+  n = htable_find(&p->unknown, key, len);
+  if (n)
+    htable_touch(&p->unknown, n);
+  else if (!htable_insert(&p->unknown, key, len, &unknown_entry))
+    return NULL;
+  while (p->unknown.count > PROVIDER_MAXUNKNOWN) {
+    htable_remove(&p->unknown, p->unknown.oldest);
+    p->unknownevictions++;
+  }
+  return &unknown_entry;
+}
+
+/**
+ * Cache a context for the server name (the provider takes a reference).
+ * A NULL context records that the name is unknown, apart from the
+ * tenants.
+ */
+p_provent provider_put(p_provider p, const char *name, SSL_CTX *ctx)
+{
+  p_hnode n;
+  p_provent e;
+  char buf[SNI_MAXNAME+1];
+  size_t len = sni_normalize(name, buf);
+  if (len == 0)
+    return NULL;
+  if (!ctx)
+    return put_unknown(p, buf, len);
+  n = htable_find(&p->unknown, buf, len);
+  if (n)
+    htable_remove(&p->unknown, n);
+  e = (p_provent)malloc(sizeof(t_provent));
+  if (!e)
+    return NULL;
+  e->context = ctx;
+  e->size = len + sizeof(t_hnode) + sizeof(t_provent) + ctx_size(ctx);
+  SSL_CTX_up_ref(ctx);
+  n = htable_find(&p->cache, buf, len);
+  if (n)
+    p->bytes -= ((p_provent)n->value)->size;
+  n = htable_insert(&p->cache, buf, len, e);
+  if (!n) {
+    free_entry(e);
+    return NULL;
+  }
+  p->bytes += e->size;
+  evict(p);
+  /* The new entry is the newest one, it is evicted only if it alone
+     exceeds the memory limit. */
+  n = htable_find(&p->cache, buf, len);
+  return n ? (p_provent)n->value : NULL;
+}
+
+/**
+ * Load "<dir>/<name>.pem" (certificate chain) and "<dir>/<name>.key".
+ * Return a new context, or NULL.
+ */
+SSL_CTX *provider_loaddir(p_provider p, const char *name)
+{
+  size_t len;
+  char *path;
+  SSL_CTX *ctx;
+  char buf[SNI_MAXNAME+1];
+  if (!p->dir || !sni_normalize(name, buf) || !valid_filename(buf))
+    return NULL;
+  len = strlen(p->dir) + strlen(buf) + 6;
+  path = (char*)malloc(len);
+  if (!path)
+    return NULL;
+  ctx = SSL_CTX_new(TLS_server_method());
+  if (ctx) {
+    snprintf(path, len, "%s/%s.pem", p->dir, buf);
+    if (SSL_CTX_use_certificate_chain_file(ctx, path) == 1) {
+      snprintf(path, len, "%s/%s.key", p->dir, buf);
+      if (SSL_CTX_use_PrivateKey_file(ctx, path, SSL_FILETYPE_PEM) != 1) {
+        SSL_CTX_free(ctx);
+        ctx = NULL;
+      }
+    } else {
+      SSL_CTX_free(ctx);
+      ctx = NULL;
+    }
+  }
+  free(path);
+  if (!ctx)
+    p->failures++;
+  return ctx;
+}
+
+/**
+ * Install the certificates, chains and keys of the context in the
+ * connection, in place of all the ones it got from its own context.
+ */
+int provider_use(SSL *ssl, SSL_CTX *ctx)
+{
+  X509 *cert;
+  EVP_PKEY *key;
+  STACK_OF(X509) *chain;
+  int n = 0;
+  int more;
+  /* A key type the context lacks must not fall back to the default one */
+  SSL_certs_clear(ssl);
+  more = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_FIRST);
+  for ( ; more; more = SSL_CTX_set_current_cert(ctx, SSL_CERT_SET_NEXT)) {
+    cert = SSL_CTX_get0_certificate(ctx);
+    key = SSL_CTX_get0_privatekey(ctx);
+    chain = NULL;
+    if (!cert || !key)
+      continue;
+    if (SSL_use_certificate(ssl, cert) != 1 ||
+        SSL_use_PrivateKey(ssl, key) != 1)
+      return 0;
+    SSL_CTX_get0_chain_certs(ctx, &chain);
+    if (SSL_set1_chain(ssl, chain) != 1)
+      return 0;
+    n++;
+  }
+  return n > 0;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef __PROVIDER_H__
+#define __PROVIDER_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+
+#include "htable.h"
+
+/* The provider relies on the certificate callback and reference counted
+ * contexts (OpenSSL 1.1.0) */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define PROVIDER_ENABLED
+#endif
+
+#define PROVIDER_MAXUNKNOWN 256     /* unknown names remembered */
+
+/* Certificate provider: contexts loaded on demand by server name and
+ * kept in a LRU bounded by number of entries and (estimated) memory.
+ * Unknown names are remembered in a small LRU of their own, so clients
+ * sending random names cannot push the tenants out. */
+typedef struct t_provider_ {
+  t_htable cache;           /* name -> p_provent */
+  t_htable unknown;         /* names without a context */
+  char *dir;                /* directory layout, or NULL */
+  int async;                /* misses suspend the handshake */
+  size_t maxentries;        /* 0: unbounded */
+  size_t maxbytes;          /* 0: unbounded */
+  size_t bytes;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long evictions;
+  unsigned long unknownevictions;
+  unsigned long failures;
+} t_provider;
+typedef t_provider* p_provider;
+
+/* Cached entry -- a NULL context records an unknown name */
+typedef struct t_provent_ {
+  SSL_CTX *context;
+  size_t size;
+} t_provent;
+typedef t_provent* p_provent;
+
+int provider_init(p_provider p, const char *dir, size_t maxentries,
+  size_t maxbytes, int async);
+void provider_free(p_provider p);
+p_provent provider_get(p_provider p, const char *name);
+p_provent provider_put(p_provider p, const char *name, SSL_CTX *ctx);
+SSL_CTX *provider_loaddir(p_provider p, const char *name);
+int provider_use(SSL *ssl, SSL_CTX *ctx);
+
+#endif
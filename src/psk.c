@@ -0,0 +1,109 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+
+#include "psk.h"
+
+#if defined(PSK_TLS13)
+/* TLS_AES_128_GCM_SHA256, the suite used with external PSKs (SHA-256) */
+static const unsigned char tls13_aes128gcmsha256[] = { 0x13, 0x01 };
+#endif
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize an empty set of keys.
+ */
+int psk_init(p_psk p)
+{
+  p->identity[0] = '\0';
+  p->key.len = 0;
+  p->hits = p->misses = 0;
+  return htable_init(&p->keys, free);
+}
+
+/**
+ * Release the keys.
+ */
+void psk_free(p_psk p)
+{
+  htable_clear(&p->keys);
+  OPENSSL_cleanse(&p->key, sizeof(p->key));
+}
+
+/**
+ * Add (or replace) the key of an identity in the server table.
+ */
+int psk_add(p_psk p, const char *identity, size_t idlen,
+  const void *key, size_t keylen)
+{
+  p_pskey k;
+  if (idlen > PSK_MAX_IDENTITY_LEN || keylen == 0 || keylen > PSK_MAX_PSK_LEN)
+    return 0;
+  k = (p_pskey)malloc(sizeof(t_pskey));
+  if (!k)
+    return 0;
+  k->len = keylen;
+  memcpy(k->data, key, keylen);
+  if (!htable_insert(&p->keys, identity, idlen, k)) {
+    free(k);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Set the client identity and key.
+ */
+int psk_set(p_psk p, const char *identity, size_t idlen,
+  const void *key, size_t keylen)
+{
+  if (idlen > PSK_MAX_IDENTITY_LEN || keylen == 0 || keylen > PSK_MAX_PSK_LEN)
+    return 0;
+  memcpy(p->identity, identity, idlen);
+  p->identity[idlen] = '\0';
+  memcpy(p->key.data, key, keylen);
+  p->key.len = keylen;
+  return 1;
+}
+
+/**
+ * Find the key of an identity in the server table.
+ */
+p_pskey psk_find(p_psk p, const char *identity, size_t idlen)
+{
+  p_hnode n = htable_find(&p->keys, identity, idlen);
+  if (!n)
+    return NULL;
+  return (p_pskey)n->value;
+}
+
+#if defined(PSK_TLS13)
+/**
+ * Build the TLS 1.3 session that carries an external PSK.
+ */
+SSL_SESSION *psk_session(SSL *ssl, p_pskey key)
+{
+  SSL_SESSION *sess;
+  const SSL_CIPHER *cipher = SSL_CIPHER_find(ssl, tls13_aes128gcmsha256);
+  if (!cipher)
+    return NULL;
+  sess = SSL_SESSION_new();
+  if (!sess)
+    return NULL;
+  if (!SSL_SESSION_set1_master_key(sess, key->data, key->len) ||
+      !SSL_SESSION_set_cipher(sess, cipher) ||
+      !SSL_SESSION_set_protocol_version(sess, TLS1_3_VERSION)) {
+    SSL_SESSION_free(sess);
+    return NULL;
+  }
+  return sess;
+}
+#endif
@@ -0,0 +1,58 @@
+#ifndef __PSK_H__
+#define __PSK_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+
+#include "htable.h"
+
+#if !defined(OPENSSL_NO_PSK)
+#define PSK_ENABLED
+/* External PSKs for TLS 1.3 */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define PSK_TLS13
+#endif
+#endif
+
+#if !defined(PSK_MAX_IDENTITY_LEN)
+#define PSK_MAX_IDENTITY_LEN 128
+#endif
+#if !defined(PSK_MAX_PSK_LEN)
+#define PSK_MAX_PSK_LEN 256
+#endif
+
+typedef struct t_pskey_ {
+  size_t len;
+  unsigned char data[PSK_MAX_PSK_LEN];
+} t_pskey;
+typedef t_pskey* p_pskey;
+
+/* Pre-shared keys: the server keeps a table of identities, the client a
+ * single identity. Keys resolved by a Lua function go to 'identity' and
+ * 'key' until the callback that asked for them returns. */
+typedef struct t_psk_ {
+  t_htable keys;            /* server: identity -> p_pskey */
+  char identity[PSK_MAX_IDENTITY_LEN + 1];
+  t_pskey key;
+  unsigned long hits;
+  unsigned long misses;
+} t_psk;
+typedef t_psk* p_psk;
+
+int psk_init(p_psk p);
+void psk_free(p_psk p);
+int psk_add(p_psk p, const char *identity, size_t idlen,
+  const void *key, size_t keylen);
+int psk_set(p_psk p, const char *identity, size_t idlen,
+  const void *key, size_t keylen);
+p_pskey psk_find(p_psk p, const char *identity, size_t idlen);
+#if defined(PSK_TLS13)
+SSL_SESSION *psk_session(SSL *ssl, p_pskey key);
+#endif
+
+#endif
@@ -0,0 +1,167 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sni.h"
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Release a trie node and its subtree.
+ */
+static void free_node(p_sninode node)
+{
+  if (node->children) {
+    htable_clear(node->children);
+    free(node->children);
+    node->children = NULL;
+  }
+}
+
+/**
+ * Release a child node (hash table callback).
+ */
+static void free_child(void *value)
+{
+  free_node((p_sninode)value);
+  free(value);
+}
+
+/**
+ * Walk the trie through the labels of 'name', from right to left.
+ * If 'create' is set, the missing nodes are added.
+ */
+static p_sninode walk(p_sninode node, const char *name, size_t len, int create)
+{
+  size_t end = len;
+  size_t start;
+  p_hnode n;
+  p_sninode child;
+  while (end > 0) {
+    start = end;
+    while (start > 0 && name[start-1] != '.')
+      start--;
+    if (start == end)
+      return NULL;          /* empty label */
+    n = node->children ? htable_find(node->children, name+start, end-start)
+                       : NULL;
+    if (n) {
+      node = (p_sninode)n->value;
+    } else {
+      if (!create)
+        return NULL;
+      if (!node->children) {
+        node->children = (p_htable)malloc(sizeof(t_htable));
+        if (!node->children)
+          return NULL;
+        if (!htable_init(node->children, free_child)) {
+          free(node->children);
+          node->children = NULL;
+          return NULL;
+        }
+      }
+      child = (p_sninode)calloc(1, sizeof(t_sninode));
+      if (!child)
+        return NULL;
+      if (!htable_insert(node->children, name+start, end-start, child)) {
+        free(child);
+        return NULL;
+      }
+      node = child;
+    }
+    end = (start > 0) ? start - 1 : 0;
+  }
+  return node;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Copy the name in lower case, without the trailing dot, to 'buf'
+ * (SNI_MAXNAME+1 bytes). Return its length, or 0 if the name is invalid.
+ */
+size_t sni_normalize(const char *name, char *buf)
+{
+  size_t i;
+  size_t len = strlen(name);
+  if (len > 0 && name[len-1] == '.')
+    len--;
+  if (len == 0 || len > SNI_MAXNAME)
+    return 0;
+  for (i = 0; i < len; i++) {
+    char c = name[i];
+    buf[i] = (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+/**
+ * Initialize an empty dispatcher.
+ */
+int sni_init(p_sni sni)
+{
+  sni->wildcards.children = NULL;
+  sni->wildcards.wildcard = NULL;
+  sni->strict = 0;
+  return htable_init(&sni->exact, NULL);
+}
+
+/**
+ * Release the dispatcher. Targets are not owned.
+ */
+void sni_free(p_sni sni)
+{
+  htable_clear(&sni->exact);
+  free_node(&sni->wildcards);
+}
+
+/**
+ * Map a name ("host.domain" or "*.domain") to a target.
+ */
+int sni_add(p_sni sni, const char *name, void *target)
+{
+  p_sninode node;
+  char buf[SNI_MAXNAME+1];
+  size_t len = sni_normalize(name, buf);
+  if (len == 0)
+    return 0;
+  if (buf[0] == '*') {
+    if (len < 3 || buf[1] != '.')
+      return 0;
+    node = walk(&sni->wildcards, buf+2, len-2, 1);
+    if (!node)
+      return 0;
+    node->wildcard = target;
+    return 1;
+  }
+  return htable_insert(&sni->exact, buf, len, target) != NULL;
+}
+
+/**
+ * Find the target for a name: exact names first, then a wildcard
+ * covering the leftmost label. The cost depends only on the name.
+ */
+void *sni_lookup(p_sni sni, const char *name)
+{
+  p_hnode n;
+  p_sninode node;
+  char *dot;
+  char buf[SNI_MAXNAME+1];
+  size_t len = sni_normalize(name, buf);
+  if (len == 0)
+    return NULL;
+  n = htable_find(&sni->exact, buf, len);
+  if (n)
+    return n->value;
+  dot = strchr(buf, '.');
+  if (!dot || !sni->wildcards.children)
+    return NULL;
+  node = walk(&sni->wildcards, dot+1, len-(dot-buf)-1, 0);
+  return node ? node->wildcard : NULL;
+}
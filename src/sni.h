@@ -0,0 +1,36 @@
+#ifndef __SNI_H__
+#define __SNI_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include "htable.h"
+
+/* Longest DNS name accepted, without the trailing dot */
+#define SNI_MAXNAME 253
+
+/* Node of the wildcard trie, indexed by labels from right to left */
+typedef struct t_sninode_ {
+  p_htable children;        /* label -> p_sninode, created on demand */
+  void *wildcard;           /* target of "*.<suffix of this node>" */
+} t_sninode;
+typedef t_sninode* p_sninode;
+
+/* Server name dispatcher: exact names and wildcards to targets */
+typedef struct t_sni_ {
+  t_htable exact;
+  t_sninode wildcards;
+  int strict;               /* reject unknown names */
+} t_sni;
+typedef t_sni* p_sni;
+
+size_t sni_normalize(const char *name, char *buf);
+int sni_init(p_sni sni);
+void sni_free(p_sni sni);
+int sni_add(p_sni sni, const char *name, void *target);
+void *sni_lookup(p_sni sni, const char *name);
+
+#endif
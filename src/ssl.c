@@ -4,6 +4,7 @@
  *
  *--------------------------------------------------------------------------*/
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <openssl/ssl.h>
@@ -18,6 +19,7 @@
 #include "socket.h"
 #include "ssl.h"
 #include "session.h"
+#include "probes.h"
 
 /**
  * Map error code into string.
@@ -33,7 +35,16 @@ static const char *ssl_ioerror(void *ctx, int err)
     case SSL_ERROR_WANT_WRITE: return "wantwrite";
     case SSL_ERROR_WANT_CONNECT: return "'connect' not completed";
     case SSL_ERROR_WANT_ACCEPT: return "'accept' not completed";
-    case SSL_ERROR_WANT_X509_LOOKUP: return "Waiting for callback";
+    case SSL_ERROR_WANT_X509_LOOKUP:
+#if defined(GOVERNOR_ENABLED)
+      /* A session not resumed waits for a place */
+      if (governor_waiting(ssl->ssl))
+        return "deferred";
+#endif
+      return "Waiting for callback";
+#if defined(SSL_ERROR_WANT_CLIENT_HELLO_CB)
+    case SSL_ERROR_WANT_CLIENT_HELLO_CB: return "deferred";
+#endif
     case SSL_ERROR_SYSCALL: return "System error";
     case SSL_ERROR_SSL: return ERR_reason_error_string(ERR_get_error());
     default: return "Unknown SSL error";
@@ -42,46 +53,144 @@ static const char *ssl_ioerror(void *ctx, int err)
   return socket_strerror(err);
 }
 
+/**
+ * Return 1 if the operation did not fail but has to be called again.
+ */
+static int ssl_retry(p_ssl ssl, int err)
+{
+  if (err != IO_SSL)
+    return 0;
+  switch (ssl->error) {
+  case SSL_ERROR_WANT_READ:
+  case SSL_ERROR_WANT_WRITE:
+  case SSL_ERROR_WANT_X509_LOOKUP:
+#if defined(SSL_ERROR_WANT_CLIENT_HELLO_CB)
+  case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+#endif
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Wait for the socket, counting the time blocked.
+ */
+static int ssl_waitfd(p_ssl ssl, int sw, p_timeout tm)
+{
+  int err;
+  double start;
+  /* Nothing to count, the socket is not waited for */
+  if (timeout_iszero(tm))
+    return IO_TIMEOUT;
+  LUASEC_PROBE3(wait_block, ssl->ssl, (long)ssl->sock, sw);
+  start = timeout_gettime();
+  err = socket_waitfd(&ssl->sock, sw, tm);
+  ssl->stats.waits++;
+  ssl->stats.waittime += timeout_gettime() - start;
+  LUASEC_PROBE3(wait_wake, ssl->ssl, (long)ssl->sock, err);
+  return err;
+}
+
+/**
+ * Record the latencies of the connection, or stop recording them.
+ */
+static int ssl_setlatency(p_ssl ssl, int on)
+{
+  if (!on) {
+    free(ssl->lat);
+    ssl->lat = NULL;
+  } else if (!ssl->lat) {
+    ssl->lat = (p_latency)calloc(1, sizeof(t_latency));
+    if (!ssl->lat)
+      return 0;
+  }
+  ssl->buf.sendlat = ssl->lat ? &ssl->lat->send : NULL;
+  ssl->buf.recvlat = ssl->lat ? &ssl->lat->receive : NULL;
+  ssl->hsstart = 0;
+  return 1;
+}
+
 /**
  * Close the connection before the GC collect the object.
  */
 static int meth_destroy(lua_State *L)
 {
+  p_context ctx;
   p_ssl ssl = (p_ssl) lua_touserdata(L, 1);
   if (ssl->ssl) {
+    ssl->L = L;
+    /* Add the counters to the context that served the connection */
+    ctx = (p_context)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl->ssl));
+    if (ctx) {
+      iostats_add(&ctx->io, &ssl->stats);
+      ctx->ioclosed++;
+      if (ctx->latency && ssl->lat)
+        latency_merge(ctx->latency, ssl->lat);
+    }
+    if (ssl->metrics)
+      ssl->metrics->open.value--;
     socket_setblocking(&ssl->sock);
     SSL_shutdown(ssl->ssl);
     socket_destroy(&ssl->sock);
     SSL_free(ssl->ssl);
     ssl->ssl = NULL;
+    luaL_unref(L, LUA_REGISTRYINDEX, ssl->ctxref);
+    ssl->ctxref = LUA_NOREF;
   }
   return 0;
 }
 
+/**
+ * Release the connection -- GC metamethod.
+ */
+static int meth_collect(lua_State *L)
+{
+  p_ssl ssl = (p_ssl) lua_touserdata(L, 1);
+  meth_destroy(L);
+  ssl_setlatency(ssl, 0);
+  return 0;
+}
+
 /**
  * Perform the TLS/SSL handshake
  */
-static int handshake(p_ssl ssl)
+static int do_handshake(p_ssl ssl)
 {
   int err;
   p_timeout tm = timeout_markstart(&ssl->tm);
   if (ssl->state == ST_SSL_CLOSED)
     return IO_CLOSED;
+  /* The latency spans the calls of a non-blocking handshake */
+  if (ssl->lat && ssl->state == ST_SSL_NEW && ssl->hsstart == 0)
+    ssl->hsstart = hist_clock();
   for ( ; ; ) {
     ERR_clear_error();
     err = SSL_do_handshake(ssl->ssl);
     ssl->error = SSL_get_error(ssl->ssl, err);
+    ssl->stats.handshakes++;
     switch(ssl->error) {
     case SSL_ERROR_NONE:
+      if (ssl->state == ST_SSL_NEW) {
+        if (SSL_session_reused(ssl->ssl))
+          LUASEC_PROBE2(session_hit, ssl->ssl, SSL_is_server(ssl->ssl));
+        else
+          LUASEC_PROBE2(session_miss, ssl->ssl, SSL_is_server(ssl->ssl));
+      }
       ssl->state = ST_SSL_CONNECTED;
+      if (ssl->lat && ssl->hsstart != 0) {
+        hist_add(&ssl->lat->handshake, hist_clock() - ssl->hsstart);
+        ssl->hsstart = 0;
+      }
       return IO_DONE;
     case SSL_ERROR_WANT_READ:
-      err = socket_waitfd(&ssl->sock, WAITFD_R, tm);
+      ssl->stats.wantread++;
+      err = ssl_waitfd(ssl, WAITFD_R, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
     case SSL_ERROR_WANT_WRITE:
-      err = socket_waitfd(&ssl->sock, WAITFD_W, tm);
+      ssl->stats.wantwrite++;
+      err = ssl_waitfd(ssl, WAITFD_W, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
@@ -100,32 +209,49 @@ static int handshake(p_ssl ssl)
   return IO_UNKNOWN;
 }
 
+/**
+ * Perform the handshake between its probes.
+ */
+static int handshake(p_ssl ssl)
+{
+  int err;
+  LUASEC_PROBE2(handshake_start, ssl->ssl, (long)ssl->sock);
+  err = do_handshake(ssl);
+  LUASEC_PROBE3(handshake_end, ssl->ssl, err, ssl->error);
+  return err;
+}
+
 /**
  * Send data
  */
-static int ssl_send(void *ctx, const char *data, size_t count, size_t *sent,
+static int do_send(p_ssl ssl, const char *data, size_t count, size_t *sent,
    p_timeout tm)
 {
   int err;
-  p_ssl ssl = (p_ssl) ctx;
+  *sent = 0;
   if (ssl->state == ST_SSL_CLOSED)
     return IO_CLOSED;
-  *sent = 0;
   for ( ; ; ) {
     ERR_clear_error();
     err = SSL_write(ssl->ssl, data, (int) count);
     ssl->error = SSL_get_error(ssl->ssl, err);
+    ssl->stats.writes++;
     switch(ssl->error) {
     case SSL_ERROR_NONE:
       *sent = err;
+      ssl->stats.sent += err;
+      if (ssl->metrics)
+        ssl->metrics->sent.value += err;
       return IO_DONE;
-    case SSL_ERROR_WANT_READ: 
-      err = socket_waitfd(&ssl->sock, WAITFD_R, tm);
+    case SSL_ERROR_WANT_READ:
+      ssl->stats.wantread++;
+      err = ssl_waitfd(ssl, WAITFD_R, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
     case SSL_ERROR_WANT_WRITE:
-      err = socket_waitfd(&ssl->sock, WAITFD_W, tm);
+      ssl->stats.wantwrite++;
+      err = ssl_waitfd(ssl, WAITFD_W, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
@@ -144,35 +270,54 @@ static int ssl_send(void *ctx, const char *data, size_t count, size_t *sent,
   return IO_UNKNOWN;
 }
 
+/**
+ * Send data between the probes.
+ */
+static int ssl_send(void *ctx, const char *data, size_t count, size_t *sent,
+   p_timeout tm)
+{
+  int err;
+  p_ssl ssl = (p_ssl) ctx;
+  LUASEC_PROBE2(send_entry, ssl->ssl, count);
+  err = do_send(ssl, data, count, sent, tm);
+  LUASEC_PROBE4(send_return, ssl->ssl, *sent, err, ssl->error);
+  return err;
+}
+
 /**
  * Receive data
  */
-static int ssl_recv(void *ctx, char *data, size_t count, size_t *got,
+static int do_recv(p_ssl ssl, char *data, size_t count, size_t *got,
   p_timeout tm)
 {
   int err;
-  p_ssl ssl = (p_ssl) ctx;
+  *got = 0;
   if (ssl->state == ST_SSL_CLOSED)
     return IO_CLOSED;
-  *got = 0;
   for ( ; ; ) {
     ERR_clear_error();
     err = SSL_read(ssl->ssl, data, (int) count);
     ssl->error = SSL_get_error(ssl->ssl, err);
+    ssl->stats.reads++;
     switch(ssl->error) {
     case SSL_ERROR_NONE:
       *got = err;
+      ssl->stats.received += err;
+      if (ssl->metrics)
+        ssl->metrics->received.value += err;
       return IO_DONE;
     case SSL_ERROR_ZERO_RETURN:
       *got = err;
       return IO_CLOSED;
     case SSL_ERROR_WANT_READ:
-      err = socket_waitfd(&ssl->sock, WAITFD_R, tm);
+      ssl->stats.wantread++;
+      err = ssl_waitfd(ssl, WAITFD_R, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
     case SSL_ERROR_WANT_WRITE:
-      err = socket_waitfd(&ssl->sock, WAITFD_W, tm);
+      ssl->stats.wantwrite++;
+      err = ssl_waitfd(ssl, WAITFD_W, tm);
       if (err == IO_TIMEOUT) return IO_SSL;
       if (err != IO_DONE)    return err;
       break;
@@ -191,12 +336,27 @@ static int ssl_recv(void *ctx, char *data, size_t count, size_t *got,
   return IO_UNKNOWN;
 }
 
+/**
+ * Receive data between the probes.
+ */
+static int ssl_recv(void *ctx, char *data, size_t count, size_t *got,
+  p_timeout tm)
+{
+  int err;
+  p_ssl ssl = (p_ssl) ctx;
+  LUASEC_PROBE2(recv_entry, ssl->ssl, count);
+  err = do_recv(ssl, data, count, got, tm);
+  LUASEC_PROBE4(recv_return, ssl->ssl, *got, err, ssl->error);
+  return err;
+}
+
 /**
  * Create a new TLS/SSL object and mark it as new.
  */
 static int meth_create(lua_State *L)
 {
   p_ssl ssl;
+  p_context pctx;
   int mode = ctx_getmode(L, 1);
   SSL_CTX *ctx = ctx_getcontext(L, 1);
 
@@ -218,6 +378,11 @@ static int meth_create(lua_State *L)
     return 2;;
   }
   ssl->state = ST_SSL_NEW;
+  ssl->L = L;
+  memset(&ssl->stats, 0, sizeof(t_iostats));
+  memset(&ssl->phases, 0, sizeof(t_phases));
+  /* The callbacks of the context find the connection */
+  SSL_set_app_data(ssl->ssl, ssl);
   SSL_set_fd(ssl->ssl, (int) SOCKET_INVALID);
   SSL_set_mode(ssl->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | 
     SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
@@ -233,6 +398,24 @@ static int meth_create(lua_State *L)
     (p_error) ssl_ioerror, ssl);
   timeout_init(&ssl->tm, -1, -1);
   buffer_init(&ssl->buf, &ssl->io, &ssl->tm);
+  ssl->lat = NULL;
+  ssl->hsstart = 0;
+  ssl->metrics = NULL;
+  ssl->hsfailed = 0;
+  ssl->certchosen = 0;
+  pctx = (p_context)SSL_CTX_get_app_data(ctx);
+  if (pctx && pctx->latency)
+    ssl_setlatency(ssl, 1);
+  /* Counted by the context that created the connection */
+  if (pctx && pctx->metrics) {
+    ssl->metrics = pctx->metrics;
+    ssl->metrics->open.value++;
+    ssl->metrics->connections.value++;
+  }
+
+  /* The callbacks of the context run until the connection is closed */
+  lua_pushvalue(L, 1);
+  ssl->ctxref = luaL_ref(L, LUA_REGISTRYINDEX);
 
   luaL_getmetatable(L, "SSL:Connection");
   lua_setmetatable(L, -2);
@@ -244,6 +427,7 @@ static int meth_create(lua_State *L)
  */
 static int meth_send(lua_State *L) {
   p_ssl ssl = (p_ssl) luaL_checkudata(L, 1, "SSL:Connection");
+  ssl->L = L;
   return buffer_meth_send(L, &ssl->buf);
 }
 
@@ -252,6 +436,7 @@ static int meth_send(lua_State *L) {
  */
 static int meth_receive(lua_State *L) {
   p_ssl ssl = (p_ssl) luaL_checkudata(L, 1, "SSL:Connection");
+  ssl->L = L;
   return buffer_meth_receive(L, &ssl->buf);
 }
 
@@ -285,14 +470,26 @@ static int meth_setfd(lua_State *L)
  */
 static int meth_handshake(lua_State *L)
 {
+  const char *msg;
   p_ssl ssl = (p_ssl) luaL_checkudata(L, 1, "SSL:Connection");
-  int err = handshake(ssl);
+  int fresh = (ssl->state == ST_SSL_NEW);
+  int err;
+  /* The callbacks call Lua on the running thread */
+  ssl->L = L;
+  err = handshake(ssl);
   if (err == IO_DONE) {
+    if (fresh && ssl->metrics)
+      metrics_handshake(ssl->metrics, ssl->ssl);
     lua_pushboolean(L, 1);
     return 1;
   }
+  msg = ssl_ioerror((void*)ssl, err);
+  if (fresh && ssl->metrics && !ssl->hsfailed && !ssl_retry(ssl, err)) {
+    metrics_failure(ssl->metrics, msg);
+    ssl->hsfailed = 1;
+  }
   lua_pushboolean(L, 0);
-  lua_pushstring(L, ssl_ioerror((void*)ssl, err));
+  lua_pushstring(L, msg);
   return 2;
 }
 
@@ -392,6 +589,184 @@ static int meth_session_reused(lua_State *L)
   return 1;
 }
 
+/**
+ * Set the server name sent by the client (SNI).
+ */
+static int meth_setservername(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  const char *name = luaL_checkstring(L, 2);
+  if (!SSL_set_tlsext_host_name(ssl->ssl, name)) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error setting server name");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Return the server name requested by the client, or nil.
+ */
+static int meth_getservername(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  const char *name = SSL_get_servername(ssl->ssl, TLSEXT_NAMETYPE_host_name);
+  if (name)
+    lua_pushstring(L, name);
+  else
+    lua_pushnil(L);
+  return 1;
+}
+
+/**
+ * Name the key type of a certificate.
+ */
+static const char *cert_keytype(X509 *cert)
+{
+  int type;
+  EVP_PKEY *key;
+  if (!cert || !(key = X509_get_pubkey(cert)))
+    return NULL;
+  type = EVP_PKEY_base_id(key);
+  EVP_PKEY_free(key);
+  switch (type) {
+  case EVP_PKEY_RSA: return "rsa";
+  case EVP_PKEY_DSA: return "dsa";
+  case EVP_PKEY_EC:  return "ecdsa";
+#if defined(EVP_PKEY_ED25519)
+  case EVP_PKEY_ED25519: return "ed25519";
+  case EVP_PKEY_ED448: return "ed448";
+#endif
+  }
+  return "unknown";
+}
+
+/**
+ * Name the AEAD family of the cipher, or NULL.
+ */
+static const char *cipher_aead(const SSL_CIPHER *cipher)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  switch (cipher ? SSL_CIPHER_get_cipher_nid(cipher) : NID_undef) {
+  case NID_aes_128_gcm:
+  case NID_aes_256_gcm:
+    return "aes-gcm";
+#if defined(NID_chacha20_poly1305)
+  case NID_chacha20_poly1305:
+    return "chacha20-poly1305";
+#endif
+  }
+#endif
+  return NULL;
+}
+
+/**
+ * Return a table with information about the connection: protocol,
+ * cipher, its strength and AEAD family, and the key type of the local
+ * and peer certificates used in the handshake.
+ */
+static int meth_info(lua_State *L)
+{
+  int bits, algbits;
+  X509 *peer;
+  const char *type;
+  const char *aead;
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  if (ssl->state != ST_SSL_CONNECTED) {
+    lua_pushnil(L);
+    lua_pushstring(L, "handshake not completed");
+    return 2;
+  }
+  lua_newtable(L);
+  lua_pushstring(L, SSL_get_version(ssl->ssl));
+  lua_setfield(L, -2, "protocol");
+  lua_pushstring(L, SSL_get_cipher_name(ssl->ssl));
+  lua_setfield(L, -2, "cipher");
+  bits = SSL_get_cipher_bits(ssl->ssl, &algbits);
+  lua_pushnumber(L, bits);
+  lua_setfield(L, -2, "bits");
+  lua_pushnumber(L, algbits);
+  lua_setfield(L, -2, "algbits");
+  aead = cipher_aead(SSL_get_current_cipher(ssl->ssl));
+  if (aead) {
+    lua_pushstring(L, aead);
+    lua_setfield(L, -2, "aead");
+  }
+  type = cert_keytype(SSL_get_certificate(ssl->ssl));
+  if (type) {
+    lua_pushstring(L, type);
+    lua_setfield(L, -2, "certificate");
+  }
+  peer = SSL_get_peer_certificate(ssl->ssl);
+  type = cert_keytype(peer);
+  if (type) {
+    lua_pushstring(L, type);
+    lua_setfield(L, -2, "peer_certificate");
+  }
+  if (peer)
+    X509_free(peer);
+  return 1;
+}
+
+/**
+ * Return a table with the I/O counters of the connection: bytes, calls
+ * to SSL_read/SSL_write/SSL_do_handshake, WANT_READ and WANT_WRITE, and
+ * the waits for the socket with the time spent in them (seconds).
+ */
+static int meth_stats(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  lua_createtable(L, 0, 9);
+  iostats_push(L, &ssl->stats, "");
+  return 1;
+}
+
+/**
+ * Return the time (seconds) from the start of the last handshake to the
+ * first ClientHello, ServerHello, Certificate, key exchange message
+ * (ServerKeyExchange, CertificateVerify or ClientKeyExchange) and
+ * Finished, and to its end; or nil if the context does not time the
+ * handshakes.
+ */
+static int meth_timing(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  timing_push_phases(L, &ssl->phases);
+  return 1;
+}
+
+/**
+ * Record the latency of the completed send(), receive() and handshake of
+ * the connection, or stop (and forget them). Connections created by a
+ * context with latencies enabled record them from the start.
+ */
+static int meth_setlatency(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  if (!ssl_setlatency(ssl, lua_toboolean(L, 2))) {
+    lua_pushboolean(L, 0);
+    lua_pushstring(L, "error creating latency histograms");
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Return the latencies of the connection, {send = hist, receive = hist,
+ * handshake = hist} with percentiles in seconds, or nil if not recorded.
+ */
+static int meth_latency(lua_State *L)
+{
+  p_ssl ssl = (p_ssl)luaL_checkudata(L, 1, "SSL:Connection");
+  if (!ssl->lat)
+    lua_pushnil(L);
+  else
+    latency_push(L, ssl->lat);
+  return 1;
+}
+
 /*---------------------------------------------------------------------------*/
 
 
@@ -410,6 +785,13 @@ static luaL_Reg meta[] = {
   {"getsession",  meth_getsession},
   {"setsession",  meth_setsession},
   {"reused",      meth_session_reused},
+  {"info",        meth_info},
+  {"stats",       meth_stats},
+  {"timing",      meth_timing},
+  {"setlatency",  meth_setlatency},
+  {"latency",     meth_latency},
+  {"setservername", meth_setservername},
+  {"getservername", meth_getservername},
   {NULL,          NULL}
 };
 
@@ -443,7 +825,7 @@ LUASEC_API int luaopen_ssl_core(lua_State *L)
   lua_newtable(L);
   luaL_register(L, NULL, meta);
   lua_setfield(L, -2, "__index");
-  lua_pushcfunction(L, meth_destroy);
+  lua_pushcfunction(L, meth_collect);
   lua_setfield(L, -2, "__gc");
 
   luaL_register(L, "ssl.core", funcs);
@@ -14,6 +14,10 @@
 #include "buffer.h"
 #include "timeout.h"
 #include "context.h"
+#include "iostats.h"
+#include "timing.h"
+#include "latency.h"
+#include "metrics.h"
 
 #define ST_SSL_NEW       1
 #define ST_SSL_CONNECTED 2
@@ -27,6 +31,16 @@ typedef struct t_ssl_ {
   SSL *ssl;
   char state;
   int error;
+  t_iostats stats;
+  t_phases phases;
+  p_latency lat;            /* latency histograms, or NULL */
+  double hsstart;           /* first dohandshake() call */
+  p_mgroup metrics;         /* exported series, or NULL */
+  char hsfailed;            /* the failure was counted */
+  char certchosen;          /* the hello function installed the pairs */
+  int ctxref;               /* keeps the context alive */
+  lua_State *L;             /* thread of the running call, for the
+                               Lua functions of the callbacks */
 } t_ssl;
 typedef t_ssl* p_ssl;
 
@@ -8,6 +8,11 @@ module("ssl", package.seeall)
 
 require("ssl.core")
 require("ssl.context")
+require("ssl.store")
+require("ssl.crl")
+require("ssl.ocsp")
+require("ssl.key")
+require("ssl.metrics")
 
 
 _VERSION   = "0.4.1"
@@ -18,6 +23,9 @@ _COPYRIGHT = "LuaSec 0.4.1 - Copyright (C) 2006-2011 Bruno Silvestre\n" ..
 rawconnection = core.rawconnection
 rawcontext    = context.rawcontext
 
+-- OCSP statuses shared by the client contexts created with "ocsp = true"
+local ocspcache
+
 --
 --
 --
@@ -32,6 +40,38 @@ local function optexec(func, param, ctx)
   return true
 end
 
+--
+--
+--
+local function optlist(param)
+   if type(param) == "table" then
+      return table.concat(param, ":")
+   end
+   return param
+end
+
+--
+--
+--
+local function loadpair(ctx, pair)
+   local succ, msg
+   if pair.keydata then
+      succ, msg = context.loadkeydata(ctx, pair.keydata, pair.password)
+      if not succ then return nil, msg end
+   elseif pair.key then
+      succ, msg = context.loadkey(ctx, pair.key, pair.password)
+      if not succ then return nil, msg end
+   end
+   if pair.certificatedata then
+      succ, msg = context.loadcertdata(ctx, pair.certificatedata)
+      if not succ then return nil, msg end
+   elseif pair.certificate then
+      succ, msg = context.loadcert(ctx, pair.certificate)
+      if not succ then return nil, msg end
+   end
+   return true
+end
+
 --
 --
 --
@@ -43,27 +83,119 @@ function newcontext(cfg)
    -- Mode
    succ, msg = context.setmode(ctx, cfg.mode)
    if not succ then return nil, msg end
-   -- Load the key
-   if cfg.key then
-      succ, msg = context.loadkey(ctx, cfg.key, cfg.password)
+   -- Load the key pair: files, strings (PEM or DER), or an ssl.key
+   succ, msg = loadpair(ctx, cfg)
+   if not succ then return nil, msg end
+   -- Load more key pairs with other key types (RSA, ECDSA, Ed25519)
+   if cfg.certificates then
+      for _, pair in ipairs(cfg.certificates) do
+         succ, msg = loadpair(ctx, pair)
+         if not succ then return nil, msg end
+      end
+   end
+   -- Load the CA certificates
+   if cfg.store then
+      succ, msg = context.setstore(ctx, cfg.store)
       if not succ then return nil, msg end
+   elseif cfg.cafile or cfg.capath or cfg.cadata then
+      if cfg.cafile or cfg.capath then
+         succ, msg = context.locations(ctx, cfg.cafile, cfg.capath)
+         if not succ then return nil, msg end
+      end
+      if cfg.cadata then
+         succ, msg = context.loadcadata(ctx, cfg.cadata)
+         if not succ then return nil, msg end
+      end
    end
-   -- Load the certificate
-   if cfg.certificate then
-      succ, msg = context.loadcert(ctx, cfg.certificate)
+   -- Pre-build the certificate chain sent to the peer
+   if cfg.chain then
+      if cfg.chain == true then
+         succ, msg = context.buildchain(ctx)
+      else
+         succ, msg = optexec(context.buildchain, cfg.chain, ctx)
+      end
       if not succ then return nil, msg end
    end
-   -- Load the CA certificates
-   if cfg.cafile or cfg.capath then
-      succ, msg = context.locations(ctx, cfg.cafile, cfg.capath)
+   -- Compress the certificates (RFC 8879), after they are loaded
+   if cfg.certcompression then
+      local algs = cfg.certcompression
+      if algs == true then algs = {"zstd", "brotli", "zlib"} end
+      succ, msg = optexec(context.setcertcompression, algs, ctx)
+      if not succ then return nil, msg end
+   end
+   -- Cache the peer verifications
+   if cfg.verifycache then
+      succ, msg = context.setverifycache(ctx, cfg.verifycache.size or 1024,
+                                         cfg.verifycache.ttl)
       if not succ then return nil, msg end
    end
    -- Set the verification options
    succ, msg = optexec(context.setverify, cfg.verify, ctx)
    if not succ then return nil, msg end
+   -- Check the revocation lists: an ssl.crl, or the sources of a new one
+   if cfg.crl then
+      local list = cfg.crl
+      if type(list) == "table" then
+         list, msg = crl.new(list)
+         if not list then return nil, msg end
+      end
+      succ, msg = context.setcrl(ctx, list)
+      if not succ then return nil, msg end
+   end
+   -- Check the OCSP status stapled by the server, or cached
+   if cfg.ocsp then
+      local cache = cfg.ocsp
+      if cache == true then
+         if not ocspcache then
+            ocspcache, msg = ocsp.new()
+            if not ocspcache then return nil, msg end
+         end
+         cache = ocspcache
+      end
+      succ, msg = context.setocsp(ctx, cache, cfg.ocsprequired)
+      if not succ then return nil, msg end
+   end
+   -- Accept only the pinned peer keys
+   if cfg.pins then
+      succ, msg = context.setpins(ctx, cfg.pins, cfg.pinchain)
+      if not succ then return nil, msg end
+   end
    -- Set SSL options
    succ, msg = optexec(context.setoptions, cfg.options, ctx)
    if not succ then return nil, msg end
+   -- Order AES-GCM and ChaCha20 for this machine
+   if cfg.cipherpreference then
+      local mode = cfg.cipherpreference
+      if mode == true then mode = "auto" end
+      succ, msg = context.setcipherpreference(ctx, mode)
+      if not succ then return nil, msg end
+   end
+   -- Set the TLS 1.2 cipher list, e.g. "PSK" for pre-shared keys
+   if cfg.ciphers then
+      succ, msg = context.setcipher(ctx, optlist(cfg.ciphers))
+      if not succ then return nil, msg end
+   end
+   -- Set the key exchange groups and the signature algorithms
+   if cfg.groups then
+      succ, msg = context.setgroups(ctx, optlist(cfg.groups))
+      if not succ then return nil, msg end
+   end
+   if cfg.sigalgs then
+      succ, msg = context.setsigalgs(ctx, optlist(cfg.sigalgs))
+      if not succ then return nil, msg end
+   end
+   -- Offer first the key share of the group each server selected before
+   if cfg.keyshare then
+      local size = cfg.keyshare
+      if size == true then size = 1024 end
+      succ, msg = context.setkeyshare(ctx, size)
+      if not succ then return nil, msg end
+   end
+   -- Pre-shared keys (identity table or lookup function)
+   if cfg.psk then
+      succ, msg = context.setpsk(ctx, cfg.psk, cfg.pskhint)
+      if not succ then return nil, msg end
+   end
    -- Set the depth for certificate verification
    if cfg.depth then
       succ, msg = context.setdepth(ctx, cfg.depth)
@@ -73,6 +205,72 @@ function newcontext(cfg)
       succ, msg = context.setsessionidcontext(ctx, cfg.cachecontext)
       if not succ then return nil, msg end
    end
+   -- Dispatch the handshakes by server name
+   if cfg.sni then
+      local names = {}
+      for name, sub in pairs(cfg.sni) do
+         if type(sub) == "table" then
+            sub, msg = newcontext(sub)
+            if not sub then return nil, msg end
+         end
+         names[name] = sub
+      end
+      succ, msg = context.setsni(ctx, names, cfg.snistrict)
+      if not succ then return nil, msg end
+   end
+   -- Load the certificates on demand by server name
+   if cfg.provider then
+      local p = cfg.provider
+      local source = p.directory
+      if p.loader then
+         source = function(name)
+            local sub = p.loader(name)
+            if type(sub) == "table" then
+               sub = newcontext(sub)
+            end
+            return sub
+         end
+      end
+      succ, msg = context.setprovider(ctx, source, p.maxentries, p.maxbytes,
+                                      p.async)
+      if not succ then return nil, msg end
+   end
+   -- Inspect the ClientHello before any expensive work
+   if cfg.clienthello then
+      local hello = cfg.clienthello
+      if type(hello) == "function" then hello = {callback = hello} end
+      succ, msg = context.setclienthello(ctx, hello.callback,
+                                         hello.requiresni, hello.minversion)
+      if not succ then return nil, msg end
+   end
+   -- Ration the full handshakes, resumptions go first
+   if cfg.governor then
+      succ, msg = context.setgovernor(ctx, cfg.governor.full,
+                                      cfg.governor.waiting)
+      if not succ then return nil, msg end
+   end
+   -- Time the phases of the handshakes
+   if cfg.timing then
+      succ, msg = context.settiming(ctx, true)
+      if not succ then return nil, msg end
+   end
+   -- Latency histograms of send(), receive() and the handshakes
+   if cfg.latency then
+      succ, msg = context.setlatency(ctx, true)
+      if not succ then return nil, msg end
+   end
+   -- Export the connections to ssl.metrics, labelled by name
+   if cfg.metrics then
+      local name = cfg.metrics
+      if name == true then name = "default" end
+      succ, msg = context.setmetrics(ctx, name)
+      if not succ then return nil, msg end
+   end
+   -- TLS 1.3 tickets sent by the server after each handshake
+   if cfg.tickets then
+      succ, msg = context.setnumtickets(ctx, cfg.tickets)
+      if not succ then return nil, msg end
+   end
    if cfg.cache then
       context.setsessioncachemode(ctx, cfg.cache)
    end
@@ -82,6 +280,15 @@ function newcontext(cfg)
    if cfg.cachesize then
       context.setcachesize(ctx, cfg.cachesize)
    end
+   -- Keep several sessions per destination on the client. After 'cache':
+   -- the store needs its own session cache mode.
+   if cfg.sessionstore then
+      local store = cfg.sessionstore
+      if store == true then store = {} end
+      succ, msg = context.setsessionstore(ctx, store.destinations,
+                                          store.sessions)
+      if not succ then return nil, msg end
+   end
    return ctx
 end
 
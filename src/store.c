@@ -0,0 +1,339 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/pem.h>
+#include <openssl/err.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "store.h"
+#include "bundle.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define X509_STORE_get0_objects(st)  ((st)->objs)
+#define X509_OBJECT_get_type(obj)    ((obj)->type)
+#define X509_STORE_up_ref(st) \
+  CRYPTO_add(&(st)->references, 1, CRYPTO_LOCK_X509_STORE)
+#endif
+
+/* SSL_CTX_set1_cert_store() appeared in OpenSSL 1.1.1 */
+#if OPENSSL_VERSION_NUMBER < 0x10101000L
+static void SSL_CTX_set1_cert_store(SSL_CTX *ctx, X509_STORE *store)
+{
+  X509_STORE_up_ref(store);
+  SSL_CTX_set_cert_store(ctx, store);
+}
+#endif
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Return the store.
+ */
+static p_store checkstore(lua_State *L, int idx)
+{
+  return (p_store)luaL_checkudata(L, idx, "SSL:Store");
+}
+
+/**
+ * Add the certificates and CRLs of a PEM string to the store.
+ */
+static int load_pem(X509_STORE *store, const char *data, size_t len)
+{
+  int i;
+  int ret = 1;
+  X509_INFO *info;
+  STACK_OF(X509_INFO) *infos;
+  BIO *bio = BIO_new_mem_buf((void*)data, (int)len);
+  if (!bio)
+    return 0;
+  infos = PEM_X509_INFO_read_bio(bio, NULL, NULL, NULL);
+  BIO_free(bio);
+  if (!infos)
+    return 0;
+  for (i = 0; ret && i < sk_X509_INFO_num(infos); i++) {
+    info = sk_X509_INFO_value(infos, i);
+    if (info->x509 && !X509_STORE_add_cert(store, info->x509))
+      ret = 0;
+    if (info->crl && !X509_STORE_add_crl(store, info->crl))
+      ret = 0;
+  }
+  sk_X509_INFO_pop_free(infos, X509_INFO_free);
+  return ret;
+}
+
+/**
+ * Build a new X509_STORE from the sources in the table at 'idx':
+ * 'cafile', 'capath' and 'pem' (string with PEM certificates).
+ * If 'cache' is also given, 'cafile' is loaded from that binary cache
+ * when it is up to date, otherwise the cache is rebuilt for next time.
+ */
+static X509_STORE *build(lua_State *L, int idx)
+{
+  size_t len;
+  const char *pem;
+  const char *cafile;
+  const char *capath;
+  const char *cache;
+  X509_STORE *store;
+  luaL_checktype(L, idx, LUA_TTABLE);
+  lua_getfield(L, idx, "cafile");
+  cafile = lua_tostring(L, -1);
+  lua_getfield(L, idx, "capath");
+  capath = lua_tostring(L, -1);
+  lua_getfield(L, idx, "pem");
+  pem = lua_tolstring(L, -1, &len);
+  lua_getfield(L, idx, "cache");
+  cache = lua_tostring(L, -1);
+  store = X509_STORE_new();
+  if (!store) {
+    lua_pop(L, 4);
+    return NULL;
+  }
+  /* A stale cache is rebuilt from the bundle parsed for the store */
+  if (cafile && cache &&
+      (bundle_load(store, cafile, cache) ||
+       bundle_compile(cafile, cache, store)))
+    cafile = NULL;
+  if ((cafile || capath) &&
+      X509_STORE_load_locations(store, cafile, capath) != 1) {
+    X509_STORE_free(store);
+    store = NULL;
+  }
+  else if (pem && !load_pem(store, pem, len)) {
+    X509_STORE_free(store);
+    store = NULL;
+  }
+  lua_pop(L, 4);
+  return store;
+}
+
+/*------------------------------ Lua Functions -------------------------------*/
+
+/**
+ * Create a store, loading the certificates once.
+ */
+static int create(lua_State *L)
+{
+  p_store st;
+  X509_STORE *store = build(L, 1);
+  if (!store) {
+    lua_pushnil(L);
+    lua_pushfstring(L, "error loading trust store (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  st = (p_store)lua_newuserdata(L, sizeof(t_store));
+  st->store = store;
+  st->generation = 0;
+  st->contexts = NULL;
+  st->ncontexts = 0;
+  st->maxcontexts = 0;
+  luaL_getmetatable(L, "SSL:Store");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+/**
+ * Load a new set of certificates aside and swap it into every context
+ * sharing the store. On error, the current certificates are kept.
+ */
+static int reload(lua_State *L)
+{
+  size_t i;
+  p_store st = checkstore(L, 1);
+  X509_STORE *store = build(L, 2);
+  if (!store) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error loading trust store (%s)",
+      ERR_reason_error_string(ERR_get_error()));
+    return 2;
+  }
+  for (i = 0; i < st->ncontexts; i++)
+    SSL_CTX_set1_cert_store(st->contexts[i], store);
+  X509_STORE_free(st->store);
+  st->store = store;
+  st->generation++;
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Write the binary cache of a PEM bundle.
+ */
+static int compile(lua_State *L)
+{
+  const char *cafile = luaL_checkstring(L, 1);
+  const char *cache = luaL_checkstring(L, 2);
+  if (!bundle_compile(cafile, cache, NULL)) {
+    lua_pushboolean(L, 0);
+    lua_pushfstring(L, "error writing the cache of '%s'", cafile);
+    return 2;
+  }
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+/**
+ * Return the number of certificates loaded in memory. Certificates of
+ * a binary cache are only counted once they were needed.
+ */
+static int count(lua_State *L)
+{
+  int i;
+  int n = 0;
+  p_store st = checkstore(L, 1);
+  STACK_OF(X509_OBJECT) *objs = X509_STORE_get0_objects(st->store);
+  for (i = 0; i < sk_X509_OBJECT_num(objs); i++) {
+    if (X509_OBJECT_get_type(sk_X509_OBJECT_value(objs, i)) == X509_LU_X509)
+      n++;
+  }
+  lua_pushnumber(L, n);
+  return 1;
+}
+
+/**
+ * Return how many times the store was reloaded.
+ */
+static int generation(lua_State *L)
+{
+  p_store st = checkstore(L, 1);
+  lua_pushnumber(L, st->generation);
+  return 1;
+}
+
+/**
+ * Package functions
+ */
+static luaL_Reg funcs[] = {
+  {"new",        create},
+  {"compile",    compile},
+  {NULL, NULL}
+};
+
+/*
+ * Store methods
+ */
+static luaL_Reg methods[] = {
+  {"reload",     reload},
+  {"count",      count},
+  {"generation", generation},
+  {NULL, NULL}
+};
+
+/*-------------------------------- Metamethods -------------------------------*/
+
+/**
+ * Collect the store -- GC metamethod.
+ */
+static int meth_destroy(lua_State *L)
+{
+  p_store st = checkstore(L, 1);
+  if (st->store) {
+    X509_STORE_free(st->store);
+    st->store = NULL;
+  }
+  free(st->contexts);
+  st->contexts = NULL;
+  st->ncontexts = st->maxcontexts = 0;
+  return 0;
+}
+
+/**
+ * Object information -- tostring metamethod.
+ */
+static int meth_tostring(lua_State *L)
+{
+  p_store st = checkstore(L, 1);
+  lua_pushfstring(L, "SSL store: %p", st);
+  return 1;
+}
+
+/**
+ * Store metamethods.
+ */
+static luaL_Reg meta[] = {
+  {"__gc",       meth_destroy},
+  {"__tostring", meth_tostring},
+  {NULL, NULL}
+};
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Retrieve the store from the Lua stack.
+ */
+p_store store_getstore(lua_State *L, int idx)
+{
+  return checkstore(L, idx);
+}
+
+/**
+ * Make room for one more context, so the next store_attach() cannot
+ * fail.
+ */
+int store_reserve(p_store st)
+{
+  if (st->ncontexts == st->maxcontexts) {
+    size_t max = st->maxcontexts ? st->maxcontexts * 2 : 8;
+    SSL_CTX **contexts = (SSL_CTX**)realloc(st->contexts,
+      max * sizeof(SSL_CTX*));
+    if (!contexts)
+      return 0;
+    st->contexts = contexts;
+    st->maxcontexts = max;
+  }
+  return 1;
+}
+
+/**
+ * Share the store with the context. The caller keeps the store alive
+ * while the context uses it.
+ */
+int store_attach(p_store st, SSL_CTX *ctx)
+{
+  if (!store_reserve(st))
+    return 0;
+  SSL_CTX_set1_cert_store(ctx, st->store);
+  st->contexts[st->ncontexts++] = ctx;
+  return 1;
+}
+
+/**
+ * Stop updating the context on reloads.
+ */
+void store_detach(p_store st, SSL_CTX *ctx)
+{
+  size_t i;
+  for (i = 0; i < st->ncontexts; i++) {
+    if (st->contexts[i] == ctx) {
+      st->contexts[i] = st->contexts[--st->ncontexts];
+      return;
+    }
+  }
+}
+
+/*------------------------------ Initialization ------------------------------*/
+
+/**
+ * Registre the module.
+ */
+LUASEC_API int luaopen_ssl_store(lua_State *L)
+{
+  luaL_newmetatable(L, "SSL:Store");
+  lua_newtable(L);
+  luaL_register(L, NULL, methods);
+  lua_setfield(L, -2, "__index");
+  luaL_register(L, NULL, meta);
+  luaL_register(L, "ssl.store", funcs);
+  return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef __STORE_H__
+#define __STORE_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <lua.h>
+
+#include "context.h"
+
+/* Trust store shared by reference between contexts */
+typedef struct t_store_ {
+  X509_STORE *store;
+  unsigned long generation;   /* incremented on each reload */
+  SSL_CTX **contexts;         /* contexts using the store */
+  size_t ncontexts;
+  size_t maxcontexts;
+} t_store;
+typedef t_store* p_store;
+
+/* Retrieve the store from the Lua stack */
+p_store store_getstore(lua_State *L, int idx);
+/* Make room to share the store with one more context */
+int store_reserve(p_store st);
+/* Share the store with a context */
+int store_attach(p_store st, SSL_CTX *ctx);
+/* Stop tracking a context */
+void store_detach(p_store st, SSL_CTX *ctx);
+
+LUASEC_API int luaopen_ssl_store(lua_State *L);
+
+#endif
@@ -0,0 +1,143 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/ssl.h>
+
+#include "tickets.h"
+
+#if defined(TICKETS_ENABLED)
+
+/* Sessions of one destination, oldest first */
+typedef struct t_tqueue_ {
+  size_t count;
+  SSL_SESSION *sessions[1];
+} t_tqueue;
+typedef t_tqueue* p_tqueue;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Release a queue and its sessions.
+ */
+static void free_queue(void *value)
+{
+  size_t i;
+  p_tqueue q = (p_tqueue)value;
+  for (i = 0; i < q->count; i++)
+    SSL_SESSION_free(q->sessions[i]);
+  free(q);
+}
+
+/**
+ * Remove the first session of a queue.
+ */
+static SSL_SESSION *shift(p_tqueue q)
+{
+  SSL_SESSION *sess = q->sessions[0];
+  q->count--;
+  memmove(q->sessions, q->sessions + 1, q->count * sizeof(SSL_SESSION*));
+  return sess;
+}
+
+/**
+ * Check if the session can still resume a connection.
+ */
+static int usable(SSL_SESSION *sess, time_t now)
+{
+  return SSL_SESSION_is_resumable(sess) &&
+    SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess) > (long)now;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize a store of 'perdest' sessions for at most 'maxdests'
+ * destinations.
+ */
+int tickets_init(p_tickets t, size_t maxdests, size_t perdest)
+{
+  t->maxdests = maxdests;
+  t->perdest = perdest > 0 ? perdest : 1;
+  t->count = 0;
+  t->hits = t->misses = 0;
+  return htable_init(&t->dests, free_queue);
+}
+
+/**
+ * Release all sessions.
+ */
+void tickets_free(p_tickets t)
+{
+  htable_clear(&t->dests);
+  t->count = 0;
+}
+
+/**
+ * Store a session received from a destination; the store takes the
+ * reference. The oldest session is dropped when the queue is full.
+ */
+int tickets_put(p_tickets t, const void *key, size_t len, SSL_SESSION *sess)
+{
+  p_tqueue q;
+  p_hnode n = htable_find(&t->dests, key, len);
+  if (n) {
+    htable_touch(&t->dests, n);
+    q = (p_tqueue)n->value;
+  } else {
+    q = (p_tqueue)malloc(sizeof(t_tqueue) +
+      (t->perdest - 1) * sizeof(SSL_SESSION*));
+    if (!q)
+      return 0;
+    q->count = 0;
+    if (!htable_insert(&t->dests, key, len, q)) {
+      free(q);
+      return 0;
+    }
+    while (t->maxdests && t->dests.count > t->maxdests) {
+      t->count -= ((p_tqueue)t->dests.oldest->value)->count;
+      htable_remove(&t->dests, t->dests.oldest);
+    }
+  }
+  if (q->count == t->perdest) {
+    SSL_SESSION_free(shift(q));
+    t->count--;
+  }
+  q->sessions[q->count++] = sess;
+  t->count++;
+  return 1;
+}
+
+/**
+ * Take a usable session of a destination, or NULL. The caller gets the
+ * reference: the session is not handed out again.
+ */
+SSL_SESSION *tickets_get(p_tickets t, const void *key, size_t len)
+{
+  p_tqueue q;
+  SSL_SESSION *sess;
+  time_t now = time(NULL);
+  p_hnode n = htable_find(&t->dests, key, len);
+  if (n) {
+    q = (p_tqueue)n->value;
+    while (q->count > 0) {
+      sess = shift(q);
+      t->count--;
+      if (usable(sess, now)) {
+        t->hits++;
+        return sess;
+      }
+      SSL_SESSION_free(sess);
+    }
+  }
+  t->misses++;
+  return NULL;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __TICKETS_H__
+#define __TICKETS_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/ssl.h>
+
+#include "htable.h"
+
+/* Several tickets per handshake and single-use tickets: TLS 1.3 */
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+#define TICKETS_ENABLED
+#endif
+
+/* Client store of the sessions (tickets) received from each destination.
+ * A ticket is handed out once, so parallel connections to the same
+ * destination each resume with a ticket of their own. */
+typedef struct t_tickets_ {
+  t_htable dests;           /* destination -> queue of sessions */
+  size_t maxdests;
+  size_t perdest;           /* sessions kept per destination */
+  size_t count;             /* sessions stored */
+  unsigned long hits;
+  unsigned long misses;
+} t_tickets;
+typedef t_tickets* p_tickets;
+
+int tickets_init(p_tickets t, size_t maxdests, size_t perdest);
+void tickets_free(p_tickets t);
+int tickets_put(p_tickets t, const void *key, size_t len, SSL_SESSION *sess);
+SSL_SESSION *tickets_get(p_tickets t, const void *key, size_t len);
+
+#endif
@@ -0,0 +1,136 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <lua.h>
+
+#include "timing.h"
+
+/* Names of the phases, after the start */
+static const char *phase_names[TIMING_PHASES - 1] = {
+  "clienthello", "serverhello", "certificate", "keyexchange", "finished",
+  "done"
+};
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Phase of a handshake message, by its type, or -1.
+ */
+static int message_phase(unsigned char type)
+{
+  switch (type) {
+  case 1:  return TIMING_CLIENTHELLO;
+  /* Also the HelloRetryRequest */
+  case 2:  return TIMING_SERVERHELLO;
+  /* Certificate, CompressedCertificate */
+  case 11:
+  case 25: return TIMING_CERTIFICATE;
+  /* ServerKeyExchange, CertificateVerify, ClientKeyExchange */
+  case 12:
+  case 15:
+  case 16: return TIMING_KEYEXCHANGE;
+  case 20: return TIMING_FINISHED;
+  }
+  return -1;
+}
+
+/**
+ * Push a table with the histogram of each phase.
+ */
+static void push_hists(lua_State *L, const t_hist *h)
+{
+  int i;
+  lua_createtable(L, 0, TIMING_PHASES - 1);
+  for (i = 0; i < TIMING_PHASES - 1; i++) {
+    hist_push(L, &h[i]);
+    lua_setfield(L, -2, phase_names[i]);
+  }
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * A handshake starts: forget the previous phases and record the new ones.
+ */
+void timing_start(p_phases ph)
+{
+  memset(ph, 0, sizeof(t_phases));
+  ph->at[TIMING_START] = hist_clock();
+  ph->armed = 1;
+}
+
+/**
+ * A handshake message was sent or received: record the first one of
+ * each phase.
+ */
+void timing_message(p_phases ph, const void *buf, size_t len)
+{
+  int phase;
+  if (!ph->armed || len < 1)
+    return;
+  phase = message_phase(*(const unsigned char*)buf);
+  if (phase > 0 && ph->at[phase] == 0)
+    ph->at[phase] = hist_clock();
+}
+
+/**
+ * The handshake is over: add its phases to the histograms of the
+ * context, if it keeps them.
+ */
+void timing_done(p_phases ph, p_timing t, int resumed)
+{
+  int i;
+  p_hist h;
+  if (!ph->armed)
+    return;
+  ph->at[TIMING_DONE] = hist_clock();
+  ph->armed = 0;
+  ph->done = 1;
+  ph->resumed = resumed;
+  if (!t)
+    return;
+  h = resumed ? t->resumed : t->full;
+  for (i = 1; i < TIMING_PHASES; i++) {
+    if (ph->at[i] != 0)
+      hist_add(&h[i - 1], ph->at[i] - ph->at[TIMING_START]);
+  }
+}
+
+/**
+ * Push the time from the start to each phase reached (seconds) and
+ * whether the session was resumed, or nil if no handshake was timed.
+ */
+void timing_push_phases(lua_State *L, const t_phases *ph)
+{
+  int i;
+  if (!ph->done) {
+    lua_pushnil(L);
+    return;
+  }
+  lua_createtable(L, 0, TIMING_PHASES);
+  for (i = 1; i < TIMING_PHASES; i++) {
+    if (ph->at[i] != 0) {
+      lua_pushnumber(L, ph->at[i] - ph->at[TIMING_START]);
+      lua_setfield(L, -2, phase_names[i - 1]);
+    }
+  }
+  lua_pushboolean(L, ph->resumed);
+  lua_setfield(L, -2, "resumed");
+}
+
+/**
+ * Push the histograms of a context: {full = {phase = hist}, resumed = ...}.
+ */
+void timing_push(lua_State *L, const t_timing *t)
+{
+  lua_createtable(L, 0, 2);
+  push_hists(L, t->full);
+  lua_setfield(L, -2, "full");
+  push_hists(L, t->resumed);
+  lua_setfield(L, -2, "resumed");
+}
@@ -0,0 +1,48 @@
+#ifndef __TIMING_H__
+#define __TIMING_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stddef.h>
+#include <lua.h>
+
+#include "hist.h"
+
+/* Handshake phases, in protocol order */
+#define TIMING_START        0
+#define TIMING_CLIENTHELLO  1
+#define TIMING_SERVERHELLO  2
+#define TIMING_CERTIFICATE  3
+#define TIMING_KEYEXCHANGE  4
+#define TIMING_FINISHED     5
+#define TIMING_DONE         6
+#define TIMING_PHASES       7
+
+/* Monotonic time (seconds) at which a connection reached each phase of
+ * its handshake, 0 if it did not. Recorded while 'armed'. */
+typedef struct t_phases_ {
+  double at[TIMING_PHASES];
+  int armed;
+  int done;
+  int resumed;
+} t_phases;
+typedef t_phases* p_phases;
+
+/* Time from the start to each phase, over the handshakes of a context */
+typedef struct t_timing_ {
+  t_hist full[TIMING_PHASES - 1];
+  t_hist resumed[TIMING_PHASES - 1];
+} t_timing;
+typedef t_timing* p_timing;
+
+void timing_start(p_phases ph);
+void timing_message(p_phases ph, const void *buf, size_t len);
+void timing_done(p_phases ph, p_timing t, int resumed);
+void timing_push_phases(lua_State *L, const t_phases *ph);
+void timing_push(lua_State *L, const t_timing *t);
+
+#endif
@@ -0,0 +1,116 @@
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "vcache.h"
+
+#define VC_MDLEN 32
+
+/* Cache key: leaf fingerprint and store identity */
+typedef struct t_vkey_ {
+  unsigned char md[VC_MDLEN];
+  const void *store;
+  unsigned long generation;
+} t_vkey;
+
+/*--------------------------- Auxiliary Functions ----------------------------*/
+
+/**
+ * Build the key of the certificate.
+ */
+static int make_key(t_vkey *key, X509 *cert, const void *store,
+  unsigned long generation)
+{
+  unsigned int len;
+  memset(key, 0, sizeof(t_vkey));
+  key->store = store;
+  key->generation = generation;
+  return X509_digest(cert, EVP_sha256(), key->md, &len) && len == VC_MDLEN;
+}
+
+/*----------------------------- Public Functions  ---------------------------*/
+
+/**
+ * Initialize an empty cache.
+ */
+int vcache_init(p_vcache vc, size_t maxentries, long ttl)
+{
+  vc->maxentries = maxentries;
+  vc->ttl = ttl;
+  vc->hits = vc->misses = 0;
+  return htable_init(&vc->entries, free);
+}
+
+/**
+ * Release the cache.
+ */
+void vcache_free(p_vcache vc)
+{
+  htable_clear(&vc->entries);
+}
+
+/**
+ * Drop all entries, e.g., when the trust store changes.
+ */
+void vcache_flush(p_vcache vc)
+{
+  while (vc->entries.oldest)
+    htable_remove(&vc->entries, vc->entries.oldest);
+}
+
+/**
+ * Return 1 if the certificate was verified with this store, less than
+ * 'ttl' seconds ago, and is still valid.
+ */
+int vcache_check(p_vcache vc, X509 *cert, const void *store,
+  unsigned long generation)
+{
+  t_vkey key;
+  p_hnode n;
+  if (!make_key(&key, cert, store, generation)) {
+    vc->misses++;
+    return 0;
+  }
+  n = htable_find(&vc->entries, &key, sizeof(t_vkey));
+  if (n && *(time_t*)n->value > time(NULL) &&
+      X509_cmp_current_time(X509_get_notAfter(cert)) > 0) {
+    htable_touch(&vc->entries, n);
+    vc->hits++;
+    return 1;
+  }
+  if (n)
+    htable_remove(&vc->entries, n);
+  vc->misses++;
+  return 0;
+}
+
+/**
+ * Record a successful verification.
+ */
+void vcache_add(p_vcache vc, X509 *cert, const void *store,
+  unsigned long generation)
+{
+  t_vkey key;
+  time_t *expires;
+  if (!make_key(&key, cert, store, generation))
+    return;
+  expires = (time_t*)malloc(sizeof(time_t));
+  if (!expires)
+    return;
+  *expires = time(NULL) + vc->ttl;
+  if (!htable_insert(&vc->entries, &key, sizeof(t_vkey), expires)) {
+    free(expires);
+    return;
+  }
+  while (vc->maxentries && vc->entries.count > vc->maxentries)
+    htable_remove(&vc->entries, vc->entries.oldest);
+}
@@ -0,0 +1,33 @@
+#ifndef __VCACHE_H__
+#define __VCACHE_H__
+
+/*--------------------------------------------------------------------------
+ * LuaSec 0.4.1
+ * Copyright (C) 2006-2011 Bruno Silvestre
+ *
+ *--------------------------------------------------------------------------*/
+
+#include <openssl/x509.h>
+
+#include "htable.h"
+
+/* Cache of successful peer verifications, keyed by the SHA-256 of the
+ * leaf certificate and the identity of the trust store. */
+typedef struct t_vcache_ {
+  t_htable entries;
+  size_t maxentries;
+  long ttl;                 /* seconds */
+  unsigned long hits;
+  unsigned long misses;
+} t_vcache;
+typedef t_vcache* p_vcache;
+
+int vcache_init(p_vcache vc, size_t maxentries, long ttl);
+void vcache_free(p_vcache vc);
+void vcache_flush(p_vcache vc);
+int vcache_check(p_vcache vc, X509 *cert, const void *store,
+  unsigned long generation);
+void vcache_add(p_vcache vc, X509 *cert, const void *store,
+  unsigned long generation);
+
+#endif